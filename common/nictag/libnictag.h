@@ -1,8 +1,112 @@
 #ifndef libnictag_h__
 #define libnictag_h__
 
+#include <sys/ethernet.h>
+
 #include <libnvpair.h>
 
+/* "xx:xx:xx:xx:xx:xx" plus a nul byte */
+#define NICTAG_MACSTRLEN	(ETHERADDRL * 3)
+
+/*
+ * one key=value line of a config file.  the pointers are into the file
+ * itself and are not nul terminated, except for keys and values set by
+ * nictag_config_set which point at copies owned by the config
+ */
+typedef struct nictag_kv {
+	const char *nk_line;	/* the whole line as read, without its newline */
+	size_t nk_linelen;	/* (NULL and 0 for lines added by an edit) */
+	const char *nk_key;
+	size_t nk_keylen;
+	const char *nk_value;
+	size_t nk_valuelen;
+	boolean_t nk_changed;	/* value replaced by nictag_config_set */
+	boolean_t nk_deleted;	/* removed by nictag_config_unset */
+} nictag_kv_t;
+
+/*
+ * a config file mapped into memory with an index of its key=value lines
+ */
+typedef struct nictag_config nictag_config_t;
+
+/*
+ * map and index the config file at "path", or /usbkey/config if "path" is
+ * NULL.  returns NULL on error.
+ * must be freed with nictag_config_close
+ */
+nictag_config_t *nictag_config_open(const char *path);
+
+/*
+ * the same, for a config that is going to be edited and written back.  an
+ * exclusive lock on "<path>.lock" is taken before the file is read (waiting
+ * for any other editor) and held until nictag_config_close, so concurrent
+ * edits are applied one after another rather than the last one to write
+ * silently dropping the others
+ */
+nictag_config_t *nictag_config_open_edit(const char *path);
+void nictag_config_close(nictag_config_t *cfg);
+
+/*
+ * return the line setting "key", or NULL if there is none.  if a key is
+ * set more than once the last line wins
+ */
+const nictag_kv_t *nictag_config_lookup(const nictag_config_t *cfg,
+    const char *key);
+
+/*
+ * return every key=value line in file order, followed by any added with
+ * nictag_config_set, and set "nkvs" to how many there are.  lines removed
+ * with nictag_config_unset are still returned with nk_deleted set
+ */
+const nictag_kv_t *nictag_config_kvs(const nictag_config_t *cfg,
+    uint_t *nkvs);
+
+/*
+ * the same as nictag_parse_config, for callers that want an nvlist.
+ * must be free()d by caller
+ */
+nvlist_t *nictag_config_nvlist(const nictag_config_t *cfg);
+
+/*
+ * the same as nictag_get_tags, straight from the index.
+ * must be free()d by caller
+ */
+nvlist_t *nictag_config_tags(const nictag_config_t *cfg);
+
+/*
+ * edit the config in memory.  nictag_config_set replaces the value of the
+ * line that sets "key" or, if there is none, adds a new line at the end.
+ * nictag_config_unset removes every line setting "key" and returns -1 if
+ * there aren't any.  either may move the lines returned by
+ * nictag_config_lookup and nictag_config_kvs, so those pointers must not
+ * be held across an edit.  return 0 on success or -1 on error
+ */
+int nictag_config_set(nictag_config_t *cfg, const char *key,
+    const char *value);
+int nictag_config_unset(nictag_config_t *cfg, const char *key);
+
+/*
+ * write every edit made since the config was opened back to its file in
+ * one go: the new contents are written to a temporary file beside it,
+ * synced and renamed over the original, so readers see either all of the
+ * edits or none of them.  comments, blank lines and lines that weren't
+ * edited are kept byte for byte and in place, and the new file gets the
+ * mode of the old one.  does nothing if there are no edits.  returns 0 on
+ * success or -1 with errno set, to EAGAIN if the file has been replaced or
+ * modified since it was read
+ */
+int nictag_config_write(nictag_config_t *cfg);
+
+/*
+ * check whether each of the "ntags" nic tags in "tags" is in the config at
+ * "path" (NULL for /usbkey/config), either as a <tag>_nic line or in the
+ * etherstub list, and set found[i] accordingly.  this is a single pass over
+ * the file that stops as soon as every tag has been found, without building
+ * an index.  returns the number found, or -1 if the file can't be read
+ */
+int nictag_config_exists(const char *path, char * const *tags, int ntags,
+    boolean_t *found);
+
 /*
  * read the nictag config and return a nul terminated
  * text buffer. returns NULL on error
@@ -39,4 +143,40 @@ char **nictag_get_etherstubs(nvlist_t *config);
  */
 void nictag_free_etherstubs(char **etherstubs);
 
+/*
+ * parse a mac address of the form "0:11:22:aa:bb:cc" (one or two hex
+ * digits per octet, either case) into "mac".  returns B_FALSE if "str"
+ * isn't exactly that
+ */
+boolean_t nictag_str2mac(const char *str, uchar_t *mac);
+
+/*
+ * format "mac" as "00:11:22:aa:bb:cc" into "buf", which must hold at least
+ * NICTAG_MACSTRLEN bytes
+ */
+void nictag_mac2str(const uchar_t *mac, char *buf);
+
+/*
+ * an index from mac address to the nic tags on it, built from the nvlist
+ * given by nictag_get_tags.  lookups are a hash probe and don't allocate;
+ * the index doesn't reference the nvlist after it is built
+ */
+typedef struct nictag_index nictag_index_t;
+
+/*
+ * build an index of "tags".  returns NULL on error.
+ * must be freed with nictag_index_free
+ */
+nictag_index_t *nictag_index_create(nvlist_t *tags);
+
+/*
+ * return the names of the tags on "mac" and set "ntags" to how many there
+ * are, or return NULL with "ntags" set to 0 if there are none.  the names
+ * are owned by the index
+ */
+char **nictag_index_lookup(const nictag_index_t *index, const uchar_t *mac,
+    uint_t *ntags);
+
+void nictag_index_free(nictag_index_t *index);
+
 #endif // libnictag_h__
@@ -1,12 +1,20 @@
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <libnvpair.h>
 #include <libdladm.h>
 
+#include "libnictag.h"
+
 #define NICTAG_CONFIG "/usbkey/config"
 
 /*
@@ -41,25 +49,49 @@ read_file(const char *fname)
 	return string;
 }
 
-static void
-mac2str(const unsigned int *macaddr, char *buf)
+static int
+hexval(char c)
 {
-	int i, n;
-	n = sprintf(buf, "%02x", *macaddr++);
-	for (i = 0; i < (ETHERADDRL - 1); i++)
-		n += sprintf(buf+n, ":%02x", *macaddr++);
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
 }
 
-static boolean_t
-str2mac(const char *buf, unsigned int *macaddr)
+boolean_t
+nictag_str2mac(const char *str, uchar_t *mac)
+{
+	int i, hi, lo;
+
+	for (i = 0; i < ETHERADDRL; i++) {
+		if (i > 0 && *str++ != ':')
+			return B_FALSE;
+		if ((hi = hexval(*str++)) < 0)
+			return B_FALSE;
+		if ((lo = hexval(*str)) >= 0) {
+			hi = hi << 4 | lo;
+			str++;
+		}
+		mac[i] = hi;
+	}
+	return *str == '\0' ? B_TRUE : B_FALSE;
+}
+
+void
+nictag_mac2str(const uchar_t *mac, char *buf)
 {
-	return sscanf(buf, "%x:%x:%x:%x:%x:%x%c",
-	    &macaddr[0],
-	    &macaddr[1],
-	    &macaddr[2],
-	    &macaddr[3],
-	    &macaddr[4],
-	    &macaddr[5]) == 6 ? B_TRUE : B_FALSE;
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < ETHERADDRL; i++) {
+		*buf++ = digits[mac[i] >> 4];
+		*buf++ = digits[mac[i] & 0xf];
+		*buf++ = ':';
+	}
+	buf[-1] = '\0';
 }
 
 char *
@@ -68,78 +100,464 @@ nictag_read_config()
 	return read_file(NICTAG_CONFIG);
 }
 
-nvlist_t *
-nictag_parse_config(char *buf)
+/*
+ * a config file and an index of its key=value lines.  nc_hash is an open
+ * addressing table of indexes into nc_kvs (plus one, so 0 is empty) keyed
+ * on the key, with a power of two number of slots
+ */
+struct nictag_config {
+	char *nc_path;
+	const char *nc_data;
+	size_t nc_size;
+	boolean_t nc_mapped;
+	nictag_kv_t *nc_kvs;
+	uint_t nc_nkvs;
+	uint_t nc_nalloc;
+	uint_t *nc_hash;
+	uint_t nc_mask;
+	size_t nc_maxline;
+	boolean_t nc_dirty;	/* edited since it was read */
+	char **nc_strs;		/* keys and values allocated by edits */
+	uint_t nc_nstrs;
+	struct stat nc_st;	/* the file as it was read */
+	int nc_lockfd;		/* held by nictag_config_open_edit, or -1 */
+};
+
+static uint32_t
+fnv(const void *buf, size_t len)
 {
-	char *p;
-	int index, offset;
-	nvlist_t *nvl;
+	const uchar_t *p = buf;
+	uint32_t h = 2166136261U;
+	size_t i;
 
-	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0)
-		return NULL;
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	return h;
+}
 
-	// read file line-by-line
-	index = 0;
-	p = buf;
-	while ((p = strchr(p, '\n')) != NULL) {
-		int len;
+/*
+ * find the slot for "key" in the hash: either the one holding it or the
+ * empty one where it belongs
+ */
+static uint_t *
+config_slot(const nictag_config_t *cfg, const char *key, size_t keylen)
+{
+	const nictag_kv_t *kv;
+	uint_t *slot;
+	uint_t i;
 
-		// arbitrarily sized
-		char line[1024];
-		char key[1024];
-		char value[1024];
+	for (i = fnv(key, keylen) & cfg->nc_mask; ;
+	    i = (i + 1) & cfg->nc_mask) {
+		slot = &cfg->nc_hash[i];
+		if (*slot == 0)
+			return slot;
+		kv = &cfg->nc_kvs[*slot - 1];
+		if (kv->nk_keylen == keylen &&
+		    memcmp(kv->nk_key, key, keylen) == 0)
+			return slot;
+	}
+}
 
-		boolean_t is_key;
-		int i, j;
+/*
+ * (re)build the hash with room for twice as many keys as there are lines
+ */
+static int
+config_rehash(nictag_config_t *cfg)
+{
+	nictag_kv_t *kv;
+	uint_t nslots = 8;
+	uint_t i;
 
-		offset = p - buf;
-		len = offset - index;
+	while (nslots < cfg->nc_nkvs * 2)
+		nslots <<= 1;
+	free(cfg->nc_hash);
+	if ((cfg->nc_hash = calloc(nslots, sizeof (uint_t))) == NULL)
+		return -1;
+	cfg->nc_mask = nslots - 1;
 
-		if (len >= sizeof (line)) {
-			fprintf(stderr, "line is too long: %d characters - skipping\n", len);
+	// later lines replace earlier ones with the same key
+	for (i = 0; i < cfg->nc_nkvs; i++) {
+		kv = &cfg->nc_kvs[i];
+		*config_slot(cfg, kv->nk_key, kv->nk_keylen) = i + 1;
+	}
+	return 0;
+}
+
+/*
+ * return a new, zeroed entry at the end of nc_kvs
+ */
+static nictag_kv_t *
+config_kv_alloc(nictag_config_t *cfg)
+{
+	nictag_kv_t *kv;
+
+	if (cfg->nc_nkvs == cfg->nc_nalloc) {
+		cfg->nc_nalloc = cfg->nc_nalloc == 0 ? 64 : cfg->nc_nalloc * 2;
+		if ((kv = realloc(cfg->nc_kvs,
+		    cfg->nc_nalloc * sizeof (nictag_kv_t))) == NULL)
+			return NULL;
+		cfg->nc_kvs = kv;
+	}
+	kv = &cfg->nc_kvs[cfg->nc_nkvs++];
+	memset(kv, 0, sizeof (*kv));
+	return kv;
+}
+
+/*
+ * index the "size" bytes at "data".  every line, including a last one with
+ * no newline, is split at its first "=" into a key and a value; blank
+ * lines and comments are skipped
+ */
+static int
+config_init(nictag_config_t *cfg, const char *data, size_t size)
+{
+	const char *p = data;
+	const char *end = data + size;
+	const char *nl, *eq;
+	nictag_kv_t *kv;
+	size_t len;
+
+	cfg->nc_data = data;
+	cfg->nc_size = size;
+
+	while (p < end) {
+		nl = memchr(p, '\n', end - p);
+		len = (nl != NULL ? nl : end) - p;
+
+		if (len == 0 || p[0] == '#')
+			goto next;
+
+		if ((eq = memchr(p, '=', len)) == NULL) {
+			// this means the line didn't have an = sign, bail
+			fprintf(stderr, "bad line in config: '%.*s'\n",
+			    (int)len, p);
 			goto next;
 		}
 
-		// copy line from "buf" to "line"
-		for (i = 0; i < len; i++)
-			line[i] = buf[index + i];
-		line[len] = '\0';
+		if ((kv = config_kv_alloc(cfg)) == NULL)
+			return -1;
+		kv->nk_line = p;
+		kv->nk_linelen = len;
+		kv->nk_key = p;
+		kv->nk_keylen = eq - p;
+		kv->nk_value = eq + 1;
+		kv->nk_valuelen = len - kv->nk_keylen - 1;
+		if (len > cfg->nc_maxline)
+			cfg->nc_maxline = len;
+next:
+		if (nl == NULL)
+			break;
+		p = nl + 1;
+	}
 
-		// skip blanks and comments
-		if (len == 0 || line[0] == '#')
-			goto next;
+	return config_rehash(cfg);
+}
 
-		// parse out key + value
-		is_key = B_TRUE;
-		for (i = 0, j = 0; i < len; i++) {
-			char c = line[i];
-			if (c == '=') {
-				is_key = B_FALSE;
-				key[i] = '\0';
-				continue;
-			}
-			if (is_key)
-				key[i] = c;
-			else
-				value[j++] = c;
+static void
+config_fini(nictag_config_t *cfg)
+{
+	uint_t i;
+
+	for (i = 0; i < cfg->nc_nstrs; i++)
+		free(cfg->nc_strs[i]);
+	free(cfg->nc_strs);
+	free(cfg->nc_kvs);
+	free(cfg->nc_hash);
+	free(cfg->nc_path);
+}
+
+/*
+ * map the config file at "path", or /usbkey/config if "path" is NULL.
+ * "data" is set to NULL for an empty file, which can't be mapped but is a
+ * valid (empty) config
+ */
+static int
+map_config(const char *path, void **data, size_t *size, struct stat *stp)
+{
+	struct stat st;
+	int fd;
+
+	if (path == NULL)
+		path = NICTAG_CONFIG;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	*data = NULL;
+	*size = st.st_size;
+	if (st.st_size > 0 && (*data = mmap(NULL, st.st_size, PROT_READ,
+	    MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if (stp != NULL)
+		*stp = st;
+	return 0;
+}
+
+/*
+ * take the edit lock for the config at "path": an fcntl lock on
+ * "<path>.lock", waiting for whoever holds it.  the lock is on a file of
+ * its own because the config itself is replaced by every write
+ */
+static int
+lock_config(const char *path)
+{
+	char lockpath[PATH_MAX];
+	struct flock fl;
+	int fd;
+
+	if (snprintf(lockpath, sizeof (lockpath), "%s.lock", path) >=
+	    (int)sizeof (lockpath)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if ((fd = open(lockpath, O_RDWR | O_CREAT | O_NOFOLLOW, 0644)) < 0)
+		return -1;
+
+	memset(&fl, 0, sizeof (fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	while (fcntl(fd, F_SETLKW, &fl) != 0) {
+		if (errno != EINTR) {
+			close(fd);
+			return -1;
 		}
-		if (is_key) {
-			// this means the line didn't have an = sign, bail
-			fprintf(stderr, "bad line in config: '%s'\n", line);
+	}
+	return fd;
+}
+
+static nictag_config_t *
+config_open(const char *path, boolean_t edit)
+{
+	nictag_config_t *cfg;
+	struct stat st;
+	void *data;
+	size_t size;
+	int lockfd = -1;
+	int e;
+
+	if (path == NULL)
+		path = NICTAG_CONFIG;
+
+	if (edit && (lockfd = lock_config(path)) < 0)
+		return NULL;
+
+	if (map_config(path, &data, &size, &st) != 0) {
+		e = errno;
+		if (lockfd >= 0)
+			close(lockfd);
+		errno = e;
+		return NULL;
+	}
+
+	if ((cfg = calloc(1, sizeof (*cfg))) == NULL) {
+		if (data != NULL)
+			munmap(data, size);
+		if (lockfd >= 0)
+			close(lockfd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	cfg->nc_mapped = data != NULL;
+	cfg->nc_st = st;
+	cfg->nc_lockfd = lockfd;
+
+	if (config_init(cfg, data, size) != 0 ||
+	    (cfg->nc_path = strdup(path)) == NULL) {
+		nictag_config_close(cfg);
+		return NULL;
+	}
+	return cfg;
+}
+
+nictag_config_t *
+nictag_config_open(const char *path)
+{
+	return config_open(path, B_FALSE);
+}
+
+nictag_config_t *
+nictag_config_open_edit(const char *path)
+{
+	return config_open(path, B_TRUE);
+}
+
+/*
+ * mark the tags in "tags" that are "name" (which is "len" bytes long and
+ * not nul terminated) as found, returning how many were newly found
+ */
+static int
+find_tag(const char *name, size_t len, char * const *tags, int ntags,
+    boolean_t *found)
+{
+	int i, n = 0;
+
+	for (i = 0; i < ntags; i++) {
+		if (!found[i] && strlen(tags[i]) == len &&
+		    memcmp(tags[i], name, len) == 0) {
+			found[i] = B_TRUE;
+			n++;
+		}
+	}
+	return n;
+}
+
+int
+nictag_config_exists(const char *path, char * const *tags, int ntags,
+    boolean_t *found)
+{
+	void *data;
+	size_t size;
+	const char *p, *end, *nl, *lend, *eq, *comma;
+	size_t len;
+	int nfound = 0;
+	int i;
+
+	for (i = 0; i < ntags; i++)
+		found[i] = B_FALSE;
+
+	if (map_config(path, &data, &size, NULL) != 0)
+		return -1;
+
+	p = data;
+	end = p + size;
+	while (p < end && nfound < ntags) {
+		nl = memchr(p, '\n', end - p);
+		lend = nl != NULL ? nl : end;
+		len = lend - p;
+
+		if (len == 0 || p[0] == '#' ||
+		    (eq = memchr(p, '=', len)) == NULL)
 			goto next;
+
+		if (eq - p > 4 && memcmp(eq - 4, "_nic", 4) == 0) {
+			// <tag>_nic=<mac>
+			nfound += find_tag(p, eq - p - 4, tags, ntags, found);
+		} else if (eq - p == 9 && memcmp(p, "etherstub", 9) == 0) {
+			// etherstub=<tag>,<tag>,...
+			for (p = eq + 1; p < lend; p = comma + 1) {
+				if ((comma = memchr(p, ',', lend - p)) == NULL)
+					comma = lend;
+				nfound += find_tag(p, comma - p, tags, ntags,
+				    found);
+			}
 		}
-		value[j] = '\0';
+next:
+		if (nl == NULL)
+			break;
+		p = nl + 1;
+	}
+
+	if (data != NULL)
+		munmap(data, size);
+	return nfound;
+}
+
+void
+nictag_config_close(nictag_config_t *cfg)
+{
+	if (cfg == NULL)
+		return;
+	if (cfg->nc_mapped)
+		munmap((void *)cfg->nc_data, cfg->nc_size);
+	// closing the lock file drops the lock
+	if (cfg->nc_lockfd >= 0)
+		close(cfg->nc_lockfd);
+	config_fini(cfg);
+	free(cfg);
+}
+
+const nictag_kv_t *
+nictag_config_lookup(const nictag_config_t *cfg, const char *key)
+{
+	uint_t *slot = config_slot(cfg, key, strlen(key));
+
+	if (*slot == 0 || cfg->nc_kvs[*slot - 1].nk_deleted)
+		return NULL;
+	return &cfg->nc_kvs[*slot - 1];
+}
+
+const nictag_kv_t *
+nictag_config_kvs(const nictag_config_t *cfg, uint_t *nkvs)
+{
+	*nkvs = cfg->nc_nkvs;
+	return cfg->nc_kvs;
+}
+
+nvlist_t *
+nictag_config_nvlist(const nictag_config_t *cfg)
+{
+	nvlist_t *nvl;
+	const nictag_kv_t *kv;
+	char *key, *value;
+	uint_t i;
+
+	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0)
+		return NULL;
+
+	// room for the key and value of the longest line, nul terminated
+	if ((key = malloc(cfg->nc_maxline + 2)) == NULL) {
+		nvlist_free(nvl);
+		return NULL;
+	}
+
+	for (i = 0; i < cfg->nc_nkvs; i++) {
+		kv = &cfg->nc_kvs[i];
+		if (kv->nk_deleted)
+			continue;
+		memcpy(key, kv->nk_key, kv->nk_keylen);
+		key[kv->nk_keylen] = '\0';
+		value = key + kv->nk_keylen + 1;
+		memcpy(value, kv->nk_value, kv->nk_valuelen);
+		value[kv->nk_valuelen] = '\0';
 
 		// store the data
 		nvlist_add_string(nvl, key, value);
-next:
-		index = offset + 1;
-		p++;
 	}
 
+	free(key);
 	return nvl;
 }
 
+nvlist_t *
+nictag_parse_config(char *buf)
+{
+	nictag_config_t cfg;
+	nvlist_t *nvl = NULL;
+
+	memset(&cfg, 0, sizeof (cfg));
+	if (config_init(&cfg, buf, strlen(buf)) == 0)
+		nvl = nictag_config_nvlist(&cfg);
+	config_fini(&cfg);
+	return nvl;
+}
+
+/*
+ * add "tag" => "mac_str" to "nvl" if "mac_str" is a mac address.  we
+ * normalize by converting the string to a mac address number, and back to
+ * a string - this also acts as validation
+ */
+static void
+add_tag(nvlist_t *nvl, const char *tag, const char *mac_str)
+{
+	char mac_normalized[NICTAG_MACSTRLEN];
+	uchar_t mac_num[ETHERADDRL];
+
+	if (!nictag_str2mac(mac_str, mac_num)) {
+		fprintf(stderr, "failed to parse mac: %s\n", mac_str);
+		return;
+	}
+	nictag_mac2str(mac_num, mac_normalized);
+	nvlist_add_string(nvl, tag, mac_normalized);
+}
+
 nvlist_t *
 nictag_get_tags(nvlist_t *config)
 {
@@ -153,31 +571,337 @@ nictag_get_tags(nvlist_t *config)
 	    curr = nvlist_next_nvpair(config, curr)) {
 		char tag[1024];
 		char *mac_str;
-		char mac_normalized[1024];
-		unsigned int mac_num[ETHERADDRL];
 		char *name = nvpair_name(curr);
 		size_t namelen = strlen(name);
 
 		// look for <tag>_nic
-		if (strncmp(name + (namelen - 4), "_nic", 4) != 0)
+		if (namelen <= 4 ||
+		    strncmp(name + (namelen - 4), "_nic", 4) != 0)
 			continue;
 		snprintf(tag, namelen - 3, "%s", name);
 
-		// extract the value (which should be a mac addr) and normalize
-		// it.  we normalize by converting the string to a mac address
-		// number, and back to a string - this also acts as validation
+		// extract the value (which should be a mac addr)
 		nvpair_value_string(curr, &mac_str);
-		if (!str2mac(mac_str, mac_num)) {
-			fprintf(stderr, "failed to parse mac: %s\n", mac_str);
+		add_tag(nvl, tag, mac_str);
+	}
+
+	return nvl;
+}
+
+nvlist_t *
+nictag_config_tags(const nictag_config_t *cfg)
+{
+	nvlist_t *nvl;
+	const nictag_kv_t *kv;
+	char *tag, *mac_str;
+	uint_t i;
+
+	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0)
+		return NULL;
+	if ((tag = malloc(cfg->nc_maxline + 2)) == NULL) {
+		nvlist_free(nvl);
+		return NULL;
+	}
+
+	for (i = 0; i < cfg->nc_nkvs; i++) {
+		kv = &cfg->nc_kvs[i];
+
+		// look for <tag>_nic
+		if (kv->nk_deleted || kv->nk_keylen <= 4 ||
+		    memcmp(kv->nk_key + kv->nk_keylen - 4, "_nic", 4) != 0)
 			continue;
-		}
-		mac2str(mac_num, mac_normalized);
-		nvlist_add_string(nvl, tag, mac_normalized);
+		memcpy(tag, kv->nk_key, kv->nk_keylen - 4);
+		tag[kv->nk_keylen - 4] = '\0';
+		mac_str = tag + kv->nk_keylen - 3;
+		memcpy(mac_str, kv->nk_value, kv->nk_valuelen);
+		mac_str[kv->nk_valuelen] = '\0';
+
+		add_tag(nvl, tag, mac_str);
 	}
 
+	free(tag);
 	return nvl;
 }
 
+/*
+ * keep a copy of "len" bytes of "str" until the config is closed
+ */
+static char *
+config_strdup(nictag_config_t *cfg, const char *str, size_t len)
+{
+	char **strs;
+	char *copy;
+
+	if ((cfg->nc_nstrs & (cfg->nc_nstrs - 1)) == 0) {
+		// nc_nstrs is 0 or a power of two: time to grow
+		if ((strs = realloc(cfg->nc_strs, (cfg->nc_nstrs == 0 ? 8 :
+		    cfg->nc_nstrs * 2) * sizeof (char *))) == NULL)
+			return NULL;
+		cfg->nc_strs = strs;
+	}
+	if ((copy = malloc(len + 1)) == NULL)
+		return NULL;
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	cfg->nc_strs[cfg->nc_nstrs++] = copy;
+	return copy;
+}
+
+int
+nictag_config_set(nictag_config_t *cfg, const char *key, const char *value)
+{
+	size_t keylen = strlen(key);
+	size_t valuelen = strlen(value);
+	uint_t *slot = config_slot(cfg, key, keylen);
+	nictag_kv_t *kv;
+	char *v;
+
+	if ((v = config_strdup(cfg, value, valuelen)) == NULL)
+		return -1;
+
+	if (*slot != 0) {
+		// replace the line in place, even if it was deleted before
+		kv = &cfg->nc_kvs[*slot - 1];
+	} else {
+		if ((kv = config_kv_alloc(cfg)) == NULL ||
+		    (kv->nk_key = config_strdup(cfg, key, keylen)) == NULL)
+			return -1;
+		kv->nk_keylen = keylen;
+		*slot = cfg->nc_nkvs;
+		if (cfg->nc_nkvs * 2 > cfg->nc_mask + 1 &&
+		    config_rehash(cfg) != 0)
+			return -1;
+	}
+
+	kv->nk_value = v;
+	kv->nk_valuelen = valuelen;
+	kv->nk_changed = B_TRUE;
+	kv->nk_deleted = B_FALSE;
+	if (keylen + 1 + valuelen > cfg->nc_maxline)
+		cfg->nc_maxline = keylen + 1 + valuelen;
+	cfg->nc_dirty = B_TRUE;
+	return 0;
+}
+
+int
+nictag_config_unset(nictag_config_t *cfg, const char *key)
+{
+	size_t keylen = strlen(key);
+	nictag_kv_t *kv;
+	uint_t i;
+
+	if (nictag_config_lookup(cfg, key) == NULL)
+		return -1;
+
+	// earlier lines with the same key would show through otherwise
+	for (i = 0; i < cfg->nc_nkvs; i++) {
+		kv = &cfg->nc_kvs[i];
+		if (!kv->nk_deleted && kv->nk_keylen == keylen &&
+		    memcmp(kv->nk_key, key, keylen) == 0) {
+			kv->nk_deleted = B_TRUE;
+		}
+	}
+	cfg->nc_dirty = B_TRUE;
+	return 0;
+}
+
+/*
+ * write "len" bytes of "buf" to "fd", retrying on short writes
+ */
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * append "key=value" at "p" and return the end of it
+ */
+static char *
+render_kv(char *p, const nictag_kv_t *kv)
+{
+	memcpy(p, kv->nk_key, kv->nk_keylen);
+	p += kv->nk_keylen;
+	*p++ = '=';
+	memcpy(p, kv->nk_value, kv->nk_valuelen);
+	return p + kv->nk_valuelen;
+}
+
+/*
+ * render the edited file: everything that wasn't touched (comments, blank
+ * lines and unchanged settings) is copied through byte for byte, changed
+ * lines are rewritten where they were, deleted lines are dropped along
+ * with their newline and new lines are appended at the end
+ */
+static char *
+config_render(const nictag_config_t *cfg, size_t *lenp)
+{
+	const char *data = cfg->nc_data;
+	const nictag_kv_t *kv;
+	size_t pos = 0, size, start, end;
+	char *buf, *p;
+	uint_t i;
+
+	// an upper bound: the old file plus every rewritten line
+	size = cfg->nc_size + 1;
+	for (i = 0; i < cfg->nc_nkvs; i++) {
+		kv = &cfg->nc_kvs[i];
+		if (kv->nk_changed)
+			size += kv->nk_keylen + kv->nk_valuelen + 2;
+	}
+	if ((buf = malloc(size)) == NULL)
+		return NULL;
+	p = buf;
+
+	for (i = 0; i < cfg->nc_nkvs; i++) {
+		kv = &cfg->nc_kvs[i];
+		if (kv->nk_line == NULL || !(kv->nk_changed || kv->nk_deleted))
+			continue;
+
+		// whatever came before this line is copied as is
+		start = kv->nk_line - data;
+		end = start + kv->nk_linelen;
+		memcpy(p, data + pos, start - pos);
+		p += start - pos;
+
+		if (kv->nk_deleted) {
+			pos = end < cfg->nc_size ? end + 1 : end;
+		} else {
+			p = render_kv(p, kv);
+			pos = end;
+		}
+	}
+	memcpy(p, data + pos, cfg->nc_size - pos);
+	p += cfg->nc_size - pos;
+
+	for (i = 0; i < cfg->nc_nkvs; i++) {
+		kv = &cfg->nc_kvs[i];
+		if (kv->nk_line != NULL || kv->nk_deleted)
+			continue;
+		if (p > buf && p[-1] != '\n')
+			*p++ = '\n';
+		p = render_kv(p, kv);
+		*p++ = '\n';
+	}
+
+	*lenp = p - buf;
+	return buf;
+}
+
+/*
+ * whether the file at the config's path is still the one that was read
+ */
+static boolean_t
+config_unchanged(const nictag_config_t *cfg, const struct stat *st)
+{
+	return st->st_dev == cfg->nc_st.st_dev &&
+	    st->st_ino == cfg->nc_st.st_ino &&
+	    st->st_size == cfg->nc_st.st_size &&
+	    st->st_mtim.tv_sec == cfg->nc_st.st_mtim.tv_sec &&
+	    st->st_mtim.tv_nsec == cfg->nc_st.st_mtim.tv_nsec;
+}
+
+/*
+ * flush the rename of the config into the directory holding it
+ */
+static int
+sync_dir(const char *path)
+{
+	char dir[PATH_MAX];
+	char *slash;
+	int fd, ret;
+
+	strlcpy(dir, path, sizeof (dir));
+	if ((slash = strrchr(dir, '/')) == NULL)
+		strlcpy(dir, ".", sizeof (dir));
+	else if (slash == dir)
+		slash[1] = '\0';
+	else
+		*slash = '\0';
+
+	if ((fd = open(dir, O_RDONLY)) < 0)
+		return -1;
+	ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+int
+nictag_config_write(nictag_config_t *cfg)
+{
+	char tmp[PATH_MAX];
+	struct stat st;
+	char *buf;
+	size_t len;
+	int fd;
+	int ret = -1;
+	int e;
+
+	if (!cfg->nc_dirty)
+		return 0;
+
+	/*
+	 * refuse to replace edits made since the config was read.  with the
+	 * lock from nictag_config_open_edit nobody else using this library
+	 * can have written it, so this catches other editors
+	 */
+	if (stat(cfg->nc_path, &st) != 0)
+		return -1;
+	if (!config_unchanged(cfg, &st)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if ((buf = config_render(cfg, &len)) == NULL)
+		return -1;
+
+	// the new file gets the mode of the one it replaces, whatever the umask
+	snprintf(tmp, sizeof (tmp), "%s.XXXXXX", cfg->nc_path);
+	if ((fd = mkstemp(tmp)) < 0) {
+		free(buf);
+		return -1;
+	}
+	if (fchmod(fd, st.st_mode & 07777) != 0 ||
+	    write_all(fd, buf, len) != 0 || fsync(fd) != 0 ||
+	    fstat(fd, &st) != 0) {
+		e = errno;
+		close(fd);
+		errno = e;
+		goto done;
+	}
+	if (close(fd) != 0)
+		goto done;
+	if (rename(tmp, cfg->nc_path) != 0)
+		goto done;
+	cfg->nc_dirty = B_FALSE;
+	cfg->nc_st = st;
+	ret = 0;
+
+	// the new contents are safe, the rename may not be yet
+	if (sync_dir(cfg->nc_path) != 0)
+		ret = -1;
+
+done:
+	if (ret != 0 && cfg->nc_dirty) {
+		e = errno;
+		unlink(tmp);
+		errno = e;
+	}
+	free(buf);
+	return ret;
+}
+
 char **
 nictag_get_etherstubs(nvlist_t *config)
 {
@@ -225,10 +949,146 @@ nictag_get_etherstubs(nvlist_t *config)
 void
 nictag_free_etherstubs(char **etherstubs)
 {
-	char *stub;
+	char **stubp;
 	if (etherstubs == NULL)
 		return;
-	while ((stub = *etherstubs++) != NULL)
-		free(stub);
+	for (stubp = etherstubs; *stubp != NULL; stubp++)
+		free(*stubp);
 	free(etherstubs);
 }
+
+/*
+ * open addressing with linear probing.  the table has a power of two number
+ * of slots, at least twice the number of distinct macs, so probes are short.
+ * the tags of every mac are stored together in ni_tags and each slot points
+ * at its run
+ */
+struct nictag_slot {
+	uchar_t ns_mac[ETHERADDRL];
+	boolean_t ns_used;
+	uint_t ns_ntags;
+	char **ns_tags;
+};
+
+struct nictag_index {
+	struct nictag_slot *ni_slots;
+	uint_t ni_mask;
+	char **ni_tags;
+	uint_t ni_ntags;	/* size of ni_tags */
+};
+
+static struct nictag_slot *
+index_slot(const nictag_index_t *index, const uchar_t *mac)
+{
+	struct nictag_slot *slot;
+	uint_t i;
+
+	for (i = fnv(mac, ETHERADDRL) & index->ni_mask; ;
+	    i = (i + 1) & index->ni_mask) {
+		slot = &index->ni_slots[i];
+		if (!slot->ns_used ||
+		    memcmp(slot->ns_mac, mac, ETHERADDRL) == 0)
+			return slot;
+	}
+}
+
+nictag_index_t *
+nictag_index_create(nvlist_t *tags)
+{
+	nictag_index_t *index;
+	nvpair_t *curr;
+	struct nictag_slot *slot;
+	uchar_t mac[ETHERADDRL];
+	char *mac_str;
+	uint_t nslots = 8;
+	uint_t i, n = 0;
+	char **next;
+
+	for (curr = nvlist_next_nvpair(tags, NULL); curr;
+	    curr = nvlist_next_nvpair(tags, curr))
+		n++;
+	while (nslots < n * 2)
+		nslots <<= 1;
+
+	if ((index = calloc(1, sizeof (*index))) == NULL)
+		return NULL;
+	index->ni_mask = nslots - 1;
+	index->ni_ntags = n;
+	if ((index->ni_slots = calloc(nslots, sizeof (struct nictag_slot))) ==
+	    NULL || (n > 0 && (index->ni_tags = calloc(n, sizeof (char *))) ==
+	    NULL)) {
+		nictag_index_free(index);
+		return NULL;
+	}
+
+	// count the tags on each mac
+	for (curr = nvlist_next_nvpair(tags, NULL); curr;
+	    curr = nvlist_next_nvpair(tags, curr)) {
+		if (nvpair_value_string(curr, &mac_str) != 0 ||
+		    !nictag_str2mac(mac_str, mac))
+			continue;
+		slot = index_slot(index, mac);
+		if (!slot->ns_used) {
+			(void) memcpy(slot->ns_mac, mac, ETHERADDRL);
+			slot->ns_used = B_TRUE;
+		}
+		slot->ns_ntags++;
+	}
+
+	// hand each mac its run of ni_tags
+	next = index->ni_tags;
+	for (i = 0; i < nslots; i++) {
+		slot = &index->ni_slots[i];
+		slot->ns_tags = next;
+		next += slot->ns_ntags;
+		slot->ns_ntags = 0;
+	}
+
+	// and fill them in, in nvlist order
+	for (curr = nvlist_next_nvpair(tags, NULL); curr;
+	    curr = nvlist_next_nvpair(tags, curr)) {
+		if (nvpair_value_string(curr, &mac_str) != 0 ||
+		    !nictag_str2mac(mac_str, mac))
+			continue;
+		slot = index_slot(index, mac);
+		if ((slot->ns_tags[slot->ns_ntags] =
+		    strdup(nvpair_name(curr))) == NULL) {
+			nictag_index_free(index);
+			return NULL;
+		}
+		slot->ns_ntags++;
+	}
+
+	return index;
+}
+
+char **
+nictag_index_lookup(const nictag_index_t *index, const uchar_t *mac,
+    uint_t *ntags)
+{
+	struct nictag_slot *slot = index_slot(index, mac);
+
+	if (!slot->ns_used) {
+		*ntags = 0;
+		return NULL;
+	}
+	*ntags = slot->ns_ntags;
+	return slot->ns_tags;
+}
+
+void
+nictag_index_free(nictag_index_t *index)
+{
+	uint_t i;
+
+	if (index == NULL)
+		return;
+	// runs of macs that failed to parse are left NULL
+	if (index->ni_tags != NULL) {
+		for (i = 0; i < index->ni_ntags; i++)
+			free(index->ni_tags[i]);
+	}
+	free(index->ni_tags);
+	free(index->ni_slots);
+	free(index);
+}
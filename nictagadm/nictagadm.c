@@ -1,5 +1,9 @@
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -9,7 +13,16 @@
 
 #include <libnictag.h>
 
+#include "nictagadm.h"
+
+// the longest nic tag name
+#define NICTAG_MAXLEN	31
+
+// most words on one line of a -f file
+#define BATCH_MAXARGS	64
+
 static struct {
+	char *opt_f; /* -f <file>, apply the edits in file */
 	boolean_t opt_v; /* -v, verbose mode */
 } opts;
 
@@ -17,20 +30,26 @@ static void
 usage(FILE *f)
 {
 	fprintf(f, "Usage: nictagadm [opts] <command>\n");
+	fprintf(f, "       nictagadm [-v] -f <file>\n");
 	fprintf(f, "\n");
 	fprintf(f, "Manage nictags\n");
 	fprintf(f, "\n");
 	fprintf(f, "Options\n");
+	fprintf(f, "  -f file  apply the add, update and delete commands in file,\n");
+	fprintf(f, "           one per line, all or nothing\n");
 	fprintf(f, "  -h       print this message and exit\n");
 	fprintf(f, "  -v       verbose output\n");
 	fprintf(f, "\n");
 	fprintf(f, "Commands\n");
-	fprintf(f, "  add      add a nictag\n");
-	fprintf(f, "  delete   delete a nictag\n");
-	fprintf(f, "  exists   check if a nictag exists\n");
+	fprintf(f, "  add      add nictags: add <tag> <mac> [<tag> <mac> ...]\n");
+	fprintf(f, "  delete   delete nictags: delete <tag> [tag ...]\n");
+	fprintf(f, "  exists   check if nictags exist, exit 1 if any don't\n");
+	fprintf(f, "           (-l: also look at the etherstubs on the system)\n");
 	fprintf(f, "  list     list nictags\n");
-	fprintf(f, "  update   update a nictag\n");
-	fprintf(f, "  vms      something\n");
+	fprintf(f, "  update   change the mac address of nictags:\n");
+	fprintf(f, "           update <tag> <mac> [<tag> <mac> ...]\n");
+	fprintf(f, "  vms      list the zones using a nictag: vms [-c cache] "
+	    "[-d dir] <tag>\n");
 }
 
 static int
@@ -46,61 +65,391 @@ walk_etherstub(dladm_handle_t handle, datalink_id_t linkid, void *arg)
 	return DLADM_WALK_CONTINUE;
 }
 
+enum edit_op {
+	EDIT_ADD,
+	EDIT_UPDATE,
+	EDIT_DELETE
+};
+
+static const char *edit_names[] = { "add", "update", "delete" };
+
+static boolean_t
+valid_tag(const char *tag)
+{
+	const char *p;
+
+	if (*tag == '\0' || strlen(tag) > NICTAG_MAXLEN)
+		return B_FALSE;
+	for (p = tag; *p != '\0'; p++) {
+		if (!isalnum((unsigned char)*p) && *p != '_')
+			return B_FALSE;
+	}
+	return B_TRUE;
+}
+
+/*
+ * whether "tag" is in the config's etherstub list
+ */
+static boolean_t
+is_etherstub(const nictag_config_t *cfg, const char *tag)
+{
+	const nictag_kv_t *kv;
+	const char *p, *end, *comma;
+	size_t len = strlen(tag);
+
+	if ((kv = nictag_config_lookup(cfg, "etherstub")) == NULL)
+		return B_FALSE;
+
+	end = kv->nk_value + kv->nk_valuelen;
+	for (p = kv->nk_value; p < end; p = comma + 1) {
+		if ((comma = memchr(p, ',', end - p)) == NULL)
+			comma = end;
+		if (comma - p == len && memcmp(p, tag, len) == 0)
+			return B_TRUE;
+	}
+	return B_FALSE;
+}
+
+/*
+ * apply one command's worth of edits to "cfg" in memory.  "argv" holds
+ * the arguments after the command name.  returns -1 after printing why
+ * if any of them can't be applied, in which case "cfg" must not be
+ * written
+ */
 static int
-do_add(int argc, char **argv)
+apply_edit(nictag_config_t *cfg, enum edit_op op, int argc, char **argv)
 {
-	printf("do_add: argc = %d, argv[0] = %s\n", argc, argv[0]);
+	char key[NICTAG_MAXLEN + sizeof ("_nic")];
+	char macstr[NICTAG_MACSTRLEN];
+	uchar_t mac[ETHERADDRL];
+	const char *name = edit_names[op];
+	int i, step = op == EDIT_DELETE ? 1 : 2;
+
+	if (argc < step || argc % step != 0) {
+		warnx("%s: expected %s", name, op == EDIT_DELETE ?
+		    "<tag> [tag ...]" : "<tag> <mac> [<tag> <mac> ...]");
+		return -1;
+	}
+
+	for (i = 0; i < argc; i += step) {
+		if (!valid_tag(argv[i])) {
+			warnx("%s: invalid nictag name: \"%s\"", name, argv[i]);
+			return -1;
+		}
+		(void) snprintf(key, sizeof (key), "%s_nic", argv[i]);
+
+		switch (op) {
+		case EDIT_ADD:
+			if (nictag_config_lookup(cfg, key) != NULL) {
+				warnx("add: nictag \"%s\" already exists",
+				    argv[i]);
+				return -1;
+			}
+			if (is_etherstub(cfg, argv[i])) {
+				warnx("add: an etherstub named \"%s\" already "
+				    "exists", argv[i]);
+				return -1;
+			}
+			break;
+		case EDIT_UPDATE:
+		case EDIT_DELETE:
+			if (nictag_config_lookup(cfg, key) == NULL) {
+				warnx("%s: nictag \"%s\" does not exist", name,
+				    argv[i]);
+				return -1;
+			}
+			break;
+		}
+
+		if (op == EDIT_DELETE) {
+			if (nictag_config_unset(cfg, key) != 0) {
+				warnx("delete: failed to remove \"%s\"",
+				    argv[i]);
+				return -1;
+			}
+		} else {
+			if (!nictag_str2mac(argv[i + 1], mac)) {
+				warnx("%s: invalid mac address: \"%s\"", name,
+				    argv[i + 1]);
+				return -1;
+			}
+			// always written in the same form sysinfo prints
+			nictag_mac2str(mac, macstr);
+			if (nictag_config_set(cfg, key, macstr) != 0) {
+				warn("%s: failed to set \"%s\"", name,
+				    argv[i]);
+				return -1;
+			}
+		}
+
+		if (opts.opt_v)
+			printf("%s %s\n", name, argv[i]);
+	}
 	return 0;
 }
 
 static int
-do_delete(int argc, char **argv)
+edit_lookup(const char *name)
 {
-	printf("do_delete: argc = %d, argv[0] = %s\n", argc, argv[0]);
+	int i;
+
+	for (i = 0; i < sizeof (edit_names) / sizeof (edit_names[0]); i++) {
+		if (strcmp(edit_names[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * write the edits in "cfg" back to the config.  the file is only replaced
+ * once, after every edit has been applied, so a bad edit anywhere leaves
+ * it untouched
+ */
+static int
+commit_edits(nictag_config_t *cfg)
+{
+	if (nictag_config_write(cfg) != 0) {
+		if (errno == EAGAIN)
+			warnx("nictag config was changed by something else "
+			    "while editing it, not writing");
+		else
+			warn("failed to write nictag config");
+		return 1;
+	}
 	return 0;
 }
 
+static int
+do_edit(enum edit_op op, int argc, char **argv)
+{
+	nictag_config_t *cfg;
+	int ret = 1;
+
+	if ((cfg = nictag_config_open_edit(NULL)) == NULL) {
+		warn("failed to read nictag config");
+		return 1;
+	}
+
+	if (apply_edit(cfg, op, argc - 1, argv + 1) == 0)
+		ret = commit_edits(cfg);
+
+	nictag_config_close(cfg);
+	return ret;
+}
+
+/*
+ * -f <file>
+ *
+ * each line of "file" is an add, update or delete command with its
+ * arguments, blank lines and lines starting with # are skipped.  all of
+ * them are applied to a single read of the config and it is written once
+ * at the end, or not at all if any of them fail
+ */
+static int
+do_batch(const char *file)
+{
+	nictag_config_t *cfg = NULL;
+	FILE *f;
+	char *line = NULL;
+	size_t linesz = 0;
+	char *args[BATCH_MAXARGS];
+	char *word, *lasts;
+	int nargs, op, lineno = 0;
+	int ret = 1;
+
+	if (strcmp(file, "-") == 0)
+		f = stdin;
+	else if ((f = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+
+	if ((cfg = nictag_config_open_edit(NULL)) == NULL) {
+		warn("failed to read nictag config");
+		goto done;
+	}
+
+	while (getline(&line, &linesz, f) >= 0) {
+		lineno++;
+		nargs = 0;
+		for (word = strtok_r(line, " \t\n", &lasts); word != NULL;
+		    word = strtok_r(NULL, " \t\n", &lasts)) {
+			if (nargs == BATCH_MAXARGS) {
+				warnx("%s:%d: too many arguments", file,
+				    lineno);
+				goto done;
+			}
+			args[nargs++] = word;
+		}
+		if (nargs == 0 || args[0][0] == '#')
+			continue;
+
+		if ((op = edit_lookup(args[0])) < 0) {
+			warnx("%s:%d: unknown command: %s", file, lineno,
+			    args[0]);
+			goto done;
+		}
+		if (apply_edit(cfg, op, nargs - 1, args + 1) != 0) {
+			warnx("%s:%d: nothing was changed", file, lineno);
+			goto done;
+		}
+	}
+	if (ferror(f)) {
+		warn("%s", file);
+		goto done;
+	}
+
+	ret = commit_edits(cfg);
+
+done:
+	if (cfg != NULL)
+		nictag_config_close(cfg);
+	if (f != stdin)
+		(void) fclose(f);
+	free(line);
+	return ret;
+}
+
+static int
+do_add(int argc, char **argv)
+{
+	return do_edit(EDIT_ADD, argc, argv);
+}
+
+static int
+do_delete(int argc, char **argv)
+{
+	return do_edit(EDIT_DELETE, argc, argv);
+}
+
+struct exists_walk {
+	char **ew_tags;
+	int ew_ntags;
+	int ew_nfound;
+	boolean_t *ew_found;
+};
+
+static int
+walk_exists(dladm_handle_t handle, datalink_id_t linkid, void *arg)
+{
+	struct exists_walk *ew = arg;
+	char name[MAXLINKNAMELEN];
+	int i;
+
+	if (dladm_datalink_id2info(handle, linkid, NULL, NULL,
+	    NULL, name, sizeof (name)) != DLADM_STATUS_OK)
+		return DLADM_WALK_CONTINUE;
+
+	for (i = 0; i < ew->ew_ntags; i++) {
+		if (!ew->ew_found[i] && strcmp(ew->ew_tags[i], name) == 0) {
+			ew->ew_found[i] = B_TRUE;
+			ew->ew_nfound++;
+		}
+	}
+
+	// nothing left to look for
+	if (ew->ew_nfound == ew->ew_ntags)
+		return DLADM_WALK_TERMINATE;
+	return DLADM_WALK_CONTINUE;
+}
+
+/*
+ * exists [-l] <tag> [tag ...]
+ *
+ * this is run for every nic of every vm that is provisioned, so the config
+ * is scanned once, stopping as soon as every tag is found, and only if some
+ * are still missing are the live etherstubs walked
+ */
 static int
 do_exists(int argc, char **argv)
 {
-	printf("do_exists: argc = %d, argv[0] = %s\n", argc, argv[0]);
-	return 0;
+	int opt, i;
+	boolean_t opt_l = B_FALSE;
+	boolean_t *found;
+	dladm_handle_t handle;
+	struct exists_walk ew;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "l")) != -1) {
+		switch (opt) {
+		case 'l':
+			opt_l = B_TRUE;
+			break;
+		default:
+			return 2;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1)
+		errx(2, "at least one nictag must be specified");
+
+	if ((found = calloc(argc, sizeof (boolean_t))) == NULL)
+		err(2, "calloc");
+
+	ew.ew_tags = argv;
+	ew.ew_ntags = argc;
+	ew.ew_found = found;
+	if ((ew.ew_nfound = nictag_config_exists(NULL, argv, argc,
+	    found)) < 0)
+		err(2, "failed to read nictag config");
+
+	if (opt_l && ew.ew_nfound < argc) {
+		if (dladm_open(&handle) != DLADM_STATUS_OK)
+			errx(2, "dladm_open failed");
+		dladm_walk_datalink_id(walk_exists, handle, &ew,
+		    DATALINK_CLASS_ETHERSTUB, DATALINK_ANY_MEDIATYPE,
+		    DLADM_OPT_ACTIVE);
+		dladm_close(handle);
+	}
+
+	for (i = 0; i < argc; i++) {
+		if (!found[i]) {
+			warnx("nictag \"%s\" does not exist", argv[i]);
+			ret = 1;
+		} else if (opts.opt_v) {
+			printf("%s\n", argv[i]);
+		}
+	}
+
+	free(found);
+	return ret;
 }
 
 static int
 do_list(int argc, char **argv)
 {
-	char *buf;
+	nictag_config_t *cfg;
 	dladm_handle_t handle = NULL;
 	nvlist_t *config = NULL;
 	nvlist_t *nictags = NULL;
 	uint32_t flags = DLADM_OPT_ACTIVE;
 	char **conf_stubs;
+	char **stubp;
 
-	buf = nictag_read_config();
-	if (buf == NULL)
+	cfg = nictag_config_open(NULL);
+	if (cfg == NULL)
 		return 1;
 
-	config = nictag_parse_config(buf);
-	if (config == NULL)
-		return 1;
-	free(buf);
-
 	// get nic tags
-	nictags = nictag_get_tags(config);
-	if (nictags == NULL)
+	nictags = nictag_config_tags(cfg);
+	if (nictags == NULL) {
+		nictag_config_close(cfg);
 		return 1;
+	}
 
 	nvlist_print_json(stdout, nictags);
 	nvlist_free(nictags);
 	printf("\n");
 
 	// get etherstubs (in the config)
+	config = nictag_config_nvlist(cfg);
+	nictag_config_close(cfg);
+	if (config == NULL)
+		return 1;
 	conf_stubs = nictag_get_etherstubs(config);
 	if (conf_stubs != NULL) {
-		char *stub;
-		while ((stub = *conf_stubs++) != NULL)
-			printf("conf stub = %s\n", stub);
+		for (stubp = conf_stubs; *stubp != NULL; stubp++)
+			printf("conf stub = %s\n", *stubp);
 	}
 	nictag_free_etherstubs(conf_stubs);
 
@@ -122,24 +471,20 @@ do_list(int argc, char **argv)
 static int
 do_update(int argc, char **argv)
 {
-	printf("do_update: argc = %d, argv[0] = %s\n", argc, argv[0]);
-	return 0;
-}
-
-static int
-do_vms(int argc, char **argv)
-{
-	printf("do_vms: argc = %d, argv[0] = %s\n", argc, argv[0]);
-	return 0;
+	return do_edit(EDIT_UPDATE, argc, argv);
 }
 
 int main(int argc, char **argv) {
 	int opt;
 	char *subcmd;
 
+	opts.opt_f = NULL;
 	opts.opt_v = B_FALSE;
-	while ((opt = getopt(argc, argv, "hv")) != -1) {
+	while ((opt = getopt(argc, argv, "f:hv")) != -1) {
 		switch (opt) {
+		case 'f':
+			opts.opt_f = optarg;
+			break;
 		case 'h':
 			usage(stdout);
 			return (0);
@@ -154,14 +499,19 @@ int main(int argc, char **argv) {
 
 	argc -= optind;
 	argv += optind;
-	optind = 0;
+
+	if (opts.opt_f != NULL) {
+		if (argc > 0)
+			errx(1, "-f can't be used with a command");
+		return do_batch(opts.opt_f);
+	}
 
 	if (argc < 1)
 		errx(1, "Command must be specified as first argument");
 
+	// commands see their own name as argv[0] and parse their own options
 	subcmd = argv[0];
-	argc--;
-	argv++;
+	optind = 1;
 
 	if (strcmp(subcmd, "add") == 0)
 		return do_add(argc, argv);
@@ -0,0 +1,7 @@
+#ifndef nictagadm_h__
+#define nictagadm_h__
+
+/* nictagadm_vms.c */
+extern int do_vms(int argc, char **argv);
+
+#endif // nictagadm_h__
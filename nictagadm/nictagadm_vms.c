@@ -0,0 +1,515 @@
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include <libnvpair.h>
+
+#include "nictagadm.h"
+
+/*
+ * vms [-c cache] [-d dir] <tag>
+ *
+ * list the zones with a nic on the given tag.  the tags each zone uses are
+ * read straight out of its configuration in /etc/zones, which is what
+ * zonecfg would tell us without forking it once per zone.  the files are
+ * read by a small pool of threads, and what was found is kept in a cache
+ * along with the mtime and size of every file, so a repeat query stats
+ * each file but reads none of them; a zone is only read again once its
+ * file changes.  the cache lives in /var/run so that only root can
+ * replace it, and one that anyone else could have written is ignored.
+ * with -d and no -c there is no cache, so looking at another directory
+ * never replaces the index of /etc/zones
+ */
+#define VMS_ZONES_DIR	"/etc/zones"
+#define VMS_CACHE	"/var/run/nictagadm.vms"
+#define VMS_CACHE_MAGIC	"nictagadm-vms 1"
+#define VMS_THREADS	8
+
+struct zone {
+	char z_name[MAXNAMELEN];
+	time_t z_mtime;
+	long z_mtime_nsec;
+	off_t z_size;
+	char *z_tags;		/* comma separated, NULL until known */
+	boolean_t z_failed;	/* couldn't be read, don't cache */
+};
+
+struct zones {
+	const char *zs_dir;
+	struct zone *zs_zones;
+	int zs_count;
+	pthread_mutex_t zs_lock;
+	int zs_next;		/* next zone for a worker to read */
+};
+
+static int
+zone_compare(const void *a, const void *b)
+{
+	return strcmp(((const struct zone *)a)->z_name,
+	    ((const struct zone *)b)->z_name);
+}
+
+/*
+ * is "tag" one of the comma separated tags in "tags"
+ */
+static boolean_t
+has_tag(const char *tags, const char *tag, size_t len)
+{
+	const char *p = tags;
+	const char *end;
+
+	while (*p != '\0') {
+		if ((end = strchr(p, ',')) == NULL)
+			end = p + strlen(p);
+		if (end - p == len && strncmp(p, tag, len) == 0)
+			return B_TRUE;
+		if (*end == '\0')
+			break;
+		p = end + 1;
+	}
+	return B_FALSE;
+}
+
+static int
+add_tag(struct zone *z, const char *tag, size_t len)
+{
+	size_t old;
+	char *tags;
+
+	if (len == 0)
+		return 0;
+	if (z->z_tags != NULL && has_tag(z->z_tags, tag, len))
+		return 0;
+
+	old = z->z_tags != NULL ? strlen(z->z_tags) : 0;
+	if ((tags = realloc(z->z_tags, old + len + 2)) == NULL)
+		return -1;
+	if (old > 0)
+		tags[old++] = ',';
+	memcpy(tags + old, tag, len);
+	tags[old + len] = '\0';
+	z->z_tags = tags;
+	return 0;
+}
+
+/*
+ * find attribute "name" of the element in [p, end) and set "value" and
+ * "len" to its raw value, with any entities left as they are (zonecfg
+ * never needs to escape a nic tag, which is a plain name).  returns
+ * B_FALSE if it isn't there
+ */
+static boolean_t
+get_attr(const char *p, const char *end, const char *name,
+    const char **value, size_t *len)
+{
+	size_t namelen = strlen(name);
+	const char *q;
+	char quote;
+
+	for (; p + namelen + 2 < end; p++) {
+		if (p[-1] != ' ' && p[-1] != '\t' && p[-1] != '\n')
+			continue;
+		if (strncmp(p, name, namelen) != 0 || p[namelen] != '=')
+			continue;
+		quote = p[namelen + 1];
+		if (quote != '"' && quote != '\'')
+			continue;
+		p += namelen + 2;
+		if ((q = memchr(p, quote, end - p)) == NULL)
+			return B_FALSE;
+		*value = p;
+		*len = q - p;
+		return B_TRUE;
+	}
+	return B_FALSE;
+}
+
+/*
+ * collect the tags from a zone's xml.  a nic's tag is either the
+ * global-nic attribute of its <network> element or a <net-attr> named
+ * global-nic or nic_tag inside it
+ */
+static int
+parse_zone(const char *dir, struct zone *z)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	const char *p, *end, *value;
+	char *buf = NULL;
+	size_t len;
+	ssize_t n;
+	size_t off = 0;
+	int fd;
+	int ret = -1;
+
+	(void) snprintf(path, sizeof (path), "%s/%s.xml", dir, z->z_name);
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		warn("open(%s)", path);
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || (buf = malloc(st.st_size + 1)) == NULL) {
+		warn("%s", path);
+		goto done;
+	}
+	while (off < st.st_size) {
+		if ((n = read(fd, buf + off, st.st_size - off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			warn("read(%s)", path);
+			goto done;
+		}
+		if (n == 0)
+			break;
+		off += n;
+	}
+	buf[off] = '\0';
+
+	// a zone with no nics still has an (empty) entry in the cache
+	if (z->z_tags == NULL && (z->z_tags = strdup("")) == NULL)
+		goto done;
+
+	for (p = buf; (p = strchr(p, '<')) != NULL; p = end) {
+		if ((end = strchr(p, '>')) == NULL)
+			break;
+
+		if (strncmp(p, "<network", 8) == 0 && (p[8] == ' ' ||
+		    p[8] == '\t' || p[8] == '\n')) {
+			if (get_attr(p + 8, end, "global-nic", &value, &len) &&
+			    add_tag(z, value, len) != 0)
+				goto done;
+		} else if (strncmp(p, "<net-attr", 9) == 0 &&
+		    get_attr(p + 9, end, "name", &value, &len)) {
+			if (!((len == 10 && strncmp(value, "global-nic",
+			    len) == 0) || (len == 7 && strncmp(value,
+			    "nic_tag", len) == 0)))
+				continue;
+			if (get_attr(p + 9, end, "value", &value, &len) &&
+			    add_tag(z, value, len) != 0)
+				goto done;
+		}
+	}
+	ret = 0;
+
+done:
+	(void) close(fd);
+	free(buf);
+	return ret;
+}
+
+static void *
+parser(void *arg)
+{
+	struct zones *zs = arg;
+	struct zone *z;
+	int i;
+
+	for (;;) {
+		(void) pthread_mutex_lock(&zs->zs_lock);
+		while (zs->zs_next < zs->zs_count &&
+		    zs->zs_zones[zs->zs_next].z_tags != NULL)
+			zs->zs_next++;
+		i = zs->zs_next++;
+		(void) pthread_mutex_unlock(&zs->zs_lock);
+
+		if (i >= zs->zs_count)
+			break;
+		z = &zs->zs_zones[i];
+		if (parse_zone(zs->zs_dir, z) != 0)
+			z->z_failed = B_TRUE;
+	}
+	return (NULL);
+}
+
+/*
+ * read every zone that the cache didn't have, on up to VMS_THREADS threads
+ */
+static int
+parse_zones(struct zones *zs, int nparse)
+{
+	pthread_t tids[VMS_THREADS];
+	int i, nthreads;
+
+	// this thread is one of the VMS_THREADS
+	nthreads = nparse < VMS_THREADS ? nparse : VMS_THREADS;
+	zs->zs_next = 0;
+	for (i = 0; i < nthreads - 1; i++) {
+		if ((errno = pthread_create(&tids[i], NULL, parser, zs)) != 0) {
+			warn("pthread_create");
+			break;
+		}
+	}
+	// whatever the threads didn't get to is read here
+	(void) parser(zs);
+	while (--i >= 0)
+		(void) pthread_join(tids[i], NULL);
+	return 0;
+}
+
+/*
+ * stat every zone config in "dir", skipping the SUNW templates
+ */
+static int
+list_zones(struct zones *zs)
+{
+	char path[PATH_MAX];
+	DIR *d;
+	struct dirent *dp;
+	struct stat st;
+	struct zone *z;
+	size_t len;
+	int nalloc = 0;
+
+	if ((d = opendir(zs->zs_dir)) == NULL) {
+		warn("opendir(%s)", zs->zs_dir);
+		return -1;
+	}
+
+	while ((dp = readdir(d)) != NULL) {
+		len = strlen(dp->d_name);
+		if (len <= 4 || strcmp(dp->d_name + len - 4, ".xml") != 0 ||
+		    strncmp(dp->d_name, "SUNW", 4) == 0)
+			continue;
+
+		(void) snprintf(path, sizeof (path), "%s/%s", zs->zs_dir,
+		    dp->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		if (zs->zs_count == nalloc) {
+			nalloc = nalloc == 0 ? 64 : nalloc * 2;
+			if ((z = realloc(zs->zs_zones,
+			    nalloc * sizeof (struct zone))) == NULL) {
+				warn("realloc");
+				(void) closedir(d);
+				return -1;
+			}
+			zs->zs_zones = z;
+		}
+		z = &zs->zs_zones[zs->zs_count++];
+		(void) memset(z, 0, sizeof (*z));
+		(void) snprintf(z->z_name, sizeof (z->z_name), "%.*s",
+		    (int)(len - 4), dp->d_name);
+		z->z_mtime = st.st_mtim.tv_sec;
+		z->z_mtime_nsec = st.st_mtim.tv_nsec;
+		z->z_size = st.st_size;
+	}
+	(void) closedir(d);
+
+	qsort(zs->zs_zones, zs->zs_count, sizeof (struct zone), zone_compare);
+	return 0;
+}
+
+/*
+ * open the cache, as long as it is a regular file that only root can write
+ */
+static FILE *
+open_cache(const char *cache)
+{
+	struct stat st;
+	FILE *f;
+	int fd;
+
+	if ((fd = open(cache, O_RDONLY | O_NOFOLLOW)) < 0)
+		return NULL;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != 0 ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+	    (f = fdopen(fd, "r")) == NULL) {
+		(void) close(fd);
+		return NULL;
+	}
+	return f;
+}
+
+/*
+ * take the tags of every zone whose file hasn't changed since the cache
+ * was written.  returns the number of cache entries that no longer match
+ * a zone, or -1 if there is no usable cache
+ */
+static int
+load_cache(struct zones *zs, const char *cache)
+{
+	FILE *f;
+	char *line = NULL;
+	char *tags;
+	size_t linesz = 0;
+	ssize_t n;
+	char name[MAXNAMELEN];
+	struct zone key, *z;
+	long long mtime, size;
+	long nsec;
+	int off;
+	int nstale = 0;
+
+	if ((f = open_cache(cache)) == NULL)
+		return -1;
+
+	// the first line names the directory the cache was built from
+	if ((n = getline(&line, &linesz, f)) <= 0 ||
+	    strncmp(line, VMS_CACHE_MAGIC " ", sizeof (VMS_CACHE_MAGIC)) != 0 ||
+	    strcspn(line + sizeof (VMS_CACHE_MAGIC), "\n") !=
+	    strlen(zs->zs_dir) || strncmp(line + sizeof (VMS_CACHE_MAGIC),
+	    zs->zs_dir, strlen(zs->zs_dir)) != 0) {
+		(void) fclose(f);
+		free(line);
+		return -1;
+	}
+
+	// the tags are whatever follows the fourth field, however long
+	while ((n = getline(&line, &linesz, f)) > 0) {
+		if (line[n - 1] == '\n')
+			line[n - 1] = '\0';
+		off = 0;
+		if (sscanf(line, "%255s %lld %ld %lld%n", name, &mtime, &nsec,
+		    &size, &off) < 4 || off == 0) {
+			nstale++;
+			continue;
+		}
+		tags = line + off;
+		if (*tags == ' ')
+			tags++;
+
+		(void) strlcpy(key.z_name, name, sizeof (key.z_name));
+		z = bsearch(&key, zs->zs_zones, zs->zs_count,
+		    sizeof (struct zone), zone_compare);
+		if (z == NULL || z->z_mtime != mtime ||
+		    z->z_mtime_nsec != nsec || z->z_size != size) {
+			nstale++;
+			continue;
+		}
+		if ((z->z_tags = strdup(tags)) == NULL) {
+			nstale++;
+			continue;
+		}
+	}
+
+	(void) fclose(f);
+	free(line);
+	return nstale;
+}
+
+/*
+ * atomically replace the cache with what we know now
+ */
+static int
+save_cache(const struct zones *zs, const char *cache)
+{
+	char tmp[PATH_MAX];
+	const struct zone *z;
+	FILE *f;
+	int fd, i;
+
+	// a fresh file of our own, so nobody can have put a link in its place
+	(void) snprintf(tmp, sizeof (tmp), "%s.XXXXXX", cache);
+	if ((fd = mkstemp(tmp)) < 0) {
+		warn("mkstemp(%s)", tmp);
+		return -1;
+	}
+	if (fchmod(fd, 0644) != 0 || (f = fdopen(fd, "w")) == NULL) {
+		warn("%s", tmp);
+		(void) close(fd);
+		(void) unlink(tmp);
+		return -1;
+	}
+
+	(void) fprintf(f, "%s %s\n", VMS_CACHE_MAGIC, zs->zs_dir);
+	for (i = 0; i < zs->zs_count; i++) {
+		z = &zs->zs_zones[i];
+		if (z->z_failed || z->z_tags == NULL)
+			continue;
+		(void) fprintf(f, "%s %lld %ld %lld %s\n", z->z_name,
+		    (long long)z->z_mtime, z->z_mtime_nsec,
+		    (long long)z->z_size, z->z_tags);
+	}
+
+	if (fclose(f) != 0) {
+		warn("write(%s)", tmp);
+		(void) unlink(tmp);
+		return -1;
+	}
+	if (rename(tmp, cache) != 0) {
+		warn("rename(%s, %s)", tmp, cache);
+		(void) unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+int
+do_vms(int argc, char **argv)
+{
+	struct zones zs;
+	const char *cache = NULL;
+	const char *tag;
+	int opt, i, nstale, nparse = 0;
+	int ret = 1;
+
+	(void) memset(&zs, 0, sizeof (zs));
+	(void) pthread_mutex_init(&zs.zs_lock, NULL);
+	zs.zs_dir = VMS_ZONES_DIR;
+
+	while ((opt = getopt(argc, argv, "c:d:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cache = optarg;
+			break;
+		case 'd':
+			zs.zs_dir = optarg;
+			break;
+		default:
+			return 2;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		errx(2, "exactly one nictag must be specified");
+	tag = argv[0];
+
+	// the default cache is only for the default directory
+	if (cache == NULL && strcmp(zs.zs_dir, VMS_ZONES_DIR) == 0)
+		cache = VMS_CACHE;
+
+	if (list_zones(&zs) != 0)
+		goto done;
+
+	nstale = cache != NULL ? load_cache(&zs, cache) : -1;
+	for (i = 0; i < zs.zs_count; i++) {
+		if (zs.zs_zones[i].z_tags == NULL)
+			nparse++;
+	}
+
+	if (nparse > 0 && parse_zones(&zs, nparse) != 0)
+		goto done;
+
+	/*
+	 * only rewrite the cache if something moved, and never let another
+	 * directory's index replace the system one
+	 */
+	if ((nparse > 0 || nstale != 0) && cache != NULL)
+		(void) save_cache(&zs, cache);
+
+	for (i = 0; i < zs.zs_count; i++) {
+		if (zs.zs_zones[i].z_tags != NULL &&
+		    has_tag(zs.zs_zones[i].z_tags, tag, strlen(tag)))
+			printf("%s\n", zs.zs_zones[i].z_name);
+	}
+	ret = 0;
+
+done:
+	for (i = 0; i < zs.zs_count; i++)
+		free(zs.zs_zones[i].z_tags);
+	free(zs.zs_zones);
+	(void) pthread_mutex_destroy(&zs.zs_lock);
+	return ret;
+}
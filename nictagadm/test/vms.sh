@@ -0,0 +1,72 @@
+#!/bin/bash
+#
+# run `nictagadm vms` against the fixture zone configs in test/zones, with
+# and without a cache
+#
+
+cd "$(dirname "$0")" || exit 1
+nictagadm=${NICTAGADM:-../nictagadm}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+failed=0
+
+# check <description> <expected> <nictagadm vms args...>
+check() {
+	local desc=$1 expected=$2 out
+	shift 2
+
+	out=$("$nictagadm" vms "$@" | tr '\n' ' ')
+	if [[ $out != "$expected" ]]; then
+		echo "FAIL: $desc: expected \"$expected\", got \"$out\""
+		failed=1
+	else
+		echo "ok: $desc"
+	fi
+}
+
+cp zones/*.xml "$tmp/" || exit 1
+dir=$tmp
+cache=$tmp/cache
+
+for pass in parsed cached; do
+	check "external ($pass)" "web0 " -d "$dir" -c "$cache" external
+	check "admin ($pass)" "db0 web0 " -d "$dir" -c "$cache" admin
+	check "nic_tag ($pass)" "db0 " -d "$dir" -c "$cache" storage
+	check "templates skipped ($pass)" "" -d "$dir" -c "$cache" default
+	check "attr isn't a nic ($pass)" "" -d "$dir" -c "$cache" owner-uuid
+done
+
+# a zone with more tags than fit on a short line
+tags=
+for i in $(seq 1 200); do
+	tags+="    <network physical=\"net$i\" global-nic=\"tag-number-$i\"/>"$'\n'
+done
+printf '<zone name="many">\n%s</zone>\n' "$tags" > "$tmp/many.xml"
+check "many tags (parsed)" "many " -d "$dir" -c "$cache" tag-number-200
+check "many tags (cached)" "many " -d "$dir" -c "$cache" tag-number-200
+
+# a changed zone is read again, a removed one is dropped
+sed -e 's/"external"/"internal"/' zones/web0.xml > "$tmp/web0.xml"
+rm "$tmp/db0.xml"
+check "changed zone" "" -d "$dir" -c "$cache" external
+check "changed zone" "web0 " -d "$dir" -c "$cache" internal
+check "removed zone" "web0 " -d "$dir" -c "$cache" admin
+
+# without -c nothing is cached
+check "no cache" "web0 " -d "$dir" admin
+
+# a cache is believed without reading the zone again, unless it could have
+# been written by anyone but root (so as anyone else, it never is)
+sed -e 's/^\(web0 [0-9]* [0-9]* [0-9]*\) .*/\1 bogus/' "$cache" > "$tmp/edited"
+cat "$tmp/edited" > "$cache"
+chmod 644 "$cache"
+if [[ $(id -u) == 0 ]]; then
+	check "trusted cache" "web0 " -d "$dir" -c "$cache" bogus
+else
+	check "cache not owned by root" "" -d "$dir" -c "$cache" bogus
+fi
+chmod 666 "$cache"
+check "untrusted cache" "" -d "$dir" -c "$cache" bogus
+
+exit $failed
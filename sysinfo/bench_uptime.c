@@ -0,0 +1,234 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utmpx.h>
+#include <kstat.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/*
+ * bench_uptime [-n records] [-i iterations] [-b position]
+ *
+ * time the three ways of finding the boot time against a synthetic utmpx
+ * file of "records" entries of login churn with a BOOT_TIME record at
+ * "position" (0 by default).  0 is where a fresh boot writes it and the
+ * best case for the scan, which stops there; utmpx slots are reused, so on
+ * a long-lived host it can be anywhere, and -b with the last position is
+ * the worst case.  the copy reads every record and the kstat none, wherever
+ * it is
+ *
+ *   copy    what sysinfo_uptime() used to do: stat the file, malloc a
+ *           struct utmpx for every record, copy each one out of
+ *           getutxent() and then scan the copy
+ *   scan    the fallback: getutxent() until the first BOOT_TIME record
+ *   kstat   unix:0:system_misc:boot_time through an open kstat handle,
+ *           which is what sysinfo_uptime() reads now
+ */
+#define BENCH_RECORDS	100000
+#define BENCH_ITERS	100
+
+static char path[PATH_MAX];
+static char dir[PATH_MAX];
+
+static void
+cleanup(void)
+{
+	if (path[0] != '\0')
+		(void) unlink(path);
+	if (dir[0] != '\0')
+		(void) rmdir(dir);
+}
+
+/*
+ * write "n" records in the on-disk (futmpx) format.  the name has to end
+ * in 'x' for utmpxname() to take it
+ */
+static void
+make_utmpx(int n, int boot)
+{
+	struct futmpx fu;
+	FILE *f;
+	int i;
+
+	(void) strlcpy(dir, "/tmp/bench_uptime.XXXXXX", sizeof (dir));
+	if (mkdtemp(dir) == NULL)
+		err(1, "mkdtemp");
+	(void) snprintf(path, sizeof (path), "%s/utmpx", dir);
+	(void) atexit(cleanup);
+
+	if ((f = fopen(path, "w")) == NULL)
+		err(1, "fopen(%s)", path);
+
+	for (i = 0; i < n; i++) {
+		(void) memset(&fu, 0, sizeof (fu));
+		fu.ut_tv.tv_sec = 1400000000 + i;
+		if (i == boot) {
+			fu.ut_type = BOOT_TIME;
+			(void) strlcpy(fu.ut_line, "system boot",
+			    sizeof (fu.ut_line));
+		} else {
+			fu.ut_type = i % 2 ? USER_PROCESS : DEAD_PROCESS;
+			fu.ut_pid = 1000 + i;
+			(void) snprintf(fu.ut_user, sizeof (fu.ut_user),
+			    "user%d", i % 50);
+			(void) snprintf(fu.ut_id, sizeof (fu.ut_id), "%d",
+			    i % 1000);
+			(void) snprintf(fu.ut_line, sizeof (fu.ut_line),
+			    "pts/%d", i % 100);
+		}
+		if (fwrite(&fu, sizeof (fu), 1, f) != 1)
+			err(1, "fwrite(%s)", path);
+	}
+	if (fclose(f) != 0)
+		err(1, "fclose(%s)", path);
+}
+
+static time_t
+by_copy(void)
+{
+	struct stat sbuf;
+	struct utmpx *ut, *utmpbegin, *utmpend, *utp;
+	size_t size;
+	time_t t = 0;
+
+	if (stat(path, &sbuf) != 0)
+		err(1, "stat(%s)", path);
+	size = sizeof (struct utmpx) * (sbuf.st_size / sizeof (struct futmpx));
+	if ((ut = malloc(size)) == NULL)
+		err(1, "malloc");
+
+	utmpbegin = ut;
+	utmpend = (struct utmpx *)((char *)utmpbegin + size);
+
+	setutxent();
+	while ((ut < utmpend) && ((utp = getutxent()) != NULL))
+		(void) memcpy(ut++, utp, sizeof (*ut));
+	endutxent();
+
+	for (ut = utmpbegin; ut < utmpend; ut++) {
+		if (ut->ut_type == BOOT_TIME) {
+			t = ut->ut_xtime;
+			break;
+		}
+	}
+	/* the old code leaked this; freeing it keeps the runs comparable */
+	free(utmpbegin);
+	return (t);
+}
+
+static time_t
+by_scan(void)
+{
+	struct utmpx *utp;
+	time_t t = 0;
+
+	setutxent();
+	while ((utp = getutxent()) != NULL) {
+		if (utp->ut_type == BOOT_TIME) {
+			t = utp->ut_xtime;
+			break;
+		}
+	}
+	endutxent();
+	return (t);
+}
+
+static kstat_ctl_t *kc;
+
+static time_t
+by_kstat(void)
+{
+	kstat_t *ksp;
+	kstat_named_t *knp;
+
+	if ((ksp = kstat_lookup(kc, "unix", 0, "system_misc")) == NULL ||
+	    kstat_read(kc, ksp, NULL) == -1 ||
+	    (knp = kstat_data_lookup(ksp, "boot_time")) == NULL)
+		errx(1, "no unix:0:system_misc:boot_time kstat");
+	return (knp->value.ui32);
+}
+
+static void
+bench(const char *name, time_t (*fn)(void), int iters)
+{
+	hrtime_t start, elapsed;
+	time_t t = 0;
+	int i;
+
+	start = gethrtime();
+	for (i = 0; i < iters; i++)
+		t = fn();
+	elapsed = gethrtime() - start;
+
+	(void) printf("%-6s %12.1f us/call  (boot time %ld)\n", name,
+	    (double)elapsed / iters / 1000, (long)t);
+}
+
+/*
+ * a non-negative decimal count, or -1 if "s" is anything else
+ */
+static int
+parse_count(const char *s)
+{
+	char *end;
+	long l;
+
+	errno = 0;
+	l = strtol(s, &end, 10);
+	if (errno != 0 || end == s || *end != '\0' || l < 0 || l > INT_MAX)
+		return (-1);
+	return ((int)l);
+}
+
+int
+main(int argc, char **argv)
+{
+	int records = BENCH_RECORDS;
+	int iters = BENCH_ITERS;
+	int boot = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:n:i:")) != -1) {
+		switch (opt) {
+		case 'n':
+			records = parse_count(optarg);
+			break;
+		case 'i':
+			iters = parse_count(optarg);
+			break;
+		case 'b':
+			boot = parse_count(optarg);
+			break;
+		default:
+			(void) fprintf(stderr, "usage: bench_uptime "
+			    "[-n records] [-i iterations] [-b position]\n");
+			return (2);
+		}
+	}
+	if (records < 1 || iters < 1)
+		errx(2, "records and iterations must be positive");
+	if (boot < 0 || boot >= records)
+		errx(2, "the BOOT_TIME position must be from 0 to %d",
+		    records - 1);
+
+	make_utmpx(records, boot);
+	if (utmpxname(path) == 0)
+		errx(1, "utmpxname(%s) failed", path);
+	if ((kc = kstat_open()) == NULL)
+		err(1, "kstat_open");
+
+	(void) printf("%d records (%ld bytes), BOOT_TIME at %d, "
+	    "%d iterations\n", records,
+	    (long)(records * sizeof (struct futmpx)), boot, iters);
+	bench("copy", by_copy, iters);
+	bench("scan", by_scan, iters);
+	bench("kstat", by_kstat, iters);
+
+	(void) kstat_close(kc);
+	return (0);
+}
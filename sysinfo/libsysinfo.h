@@ -0,0 +1,65 @@
+#ifndef libsysinfo_h__
+#define libsysinfo_h__
+
+#include <libnvpair.h>
+
+/*
+ * the sysinfo collectors as a library, for programs that want the data
+ * without running sysinfo and parsing its output.
+ *
+ * a handle holds the platform handles the collectors use and the last
+ * gathered document.  every function may be called from any thread: a
+ * gather runs while readers keep being answered from the previous
+ * document, and gathers on one handle run one at a time.
+ *
+ * functions returning int return 0 on success, or -1 with errno set:
+ * ENOENT if a key or collector doesn't exist (or nothing has been gathered
+ * yet), EINVAL if a key holds a different type, or the error of whatever
+ * failed (usually ENOMEM).
+ *
+ * a collector that can't read something leaves its keys out of the
+ * document and says why with warn(3), on stderr.  the sections sysinfo
+ * keeps for the rest of the boot (/var/run/sysinfo.boot) are used if root
+ * wrote them, but the library never writes them itself
+ */
+typedef struct sysinfo_hdl sysinfo_hdl_t;
+
+/*
+ * create a handle.  with "nthreads" greater than 1 the collectors of a
+ * gather run concurrently on that many threads.  returns NULL on error.
+ * must be freed with sysinfo_close
+ */
+extern sysinfo_hdl_t *sysinfo_open(int nthreads);
+extern void sysinfo_close(sysinfo_hdl_t *);
+
+/*
+ * run the "n" collectors named in "names" (all of them if "names" is
+ * NULL) and replace their part of the document.  sysinfo_refresh does the
+ * same for a single collector
+ */
+extern int sysinfo_update(sysinfo_hdl_t *, const char * const *names, int n);
+extern int sysinfo_refresh(sysinfo_hdl_t *, const char *name);
+
+/*
+ * the names of the collectors, in output order, terminated by NULL
+ */
+extern const char * const *sysinfo_collector_names(void);
+
+/*
+ * a copy of the current document, the same keys and values sysinfo
+ * prints.  returns NULL if nothing has been gathered.
+ * must be free()d by caller
+ */
+extern nvlist_t *sysinfo_nvlist(sysinfo_hdl_t *);
+
+/*
+ * look up a top-level key in the current document.  sysinfo_get_string
+ * returns a copy that must be free()d by caller; sysinfo_get_int takes
+ * any integer type
+ */
+extern int sysinfo_get_string(sysinfo_hdl_t *, const char *key, char **valp);
+extern int sysinfo_get_int(sysinfo_hdl_t *, const char *key, int64_t *valp);
+extern int sysinfo_get_boolean(sysinfo_hdl_t *, const char *key,
+    boolean_t *valp);
+
+#endif // libsysinfo_h__
@@ -1,81 +1,675 @@
 #include <err.h>
+#include <fcntl.h>
+#include <procfs.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include <libnvpair.h>
 
-/* included at compile time */
-extern void sysinfo_bootparams(nvlist_t *);
-extern void sysinfo_uname(nvlist_t *);
-extern void sysinfo_smartdc(nvlist_t *);
-extern void sysinfo_smbios(nvlist_t *);
-extern void sysinfo_uptime(nvlist_t *);
-extern void sysinfo_sysconf(nvlist_t *);
-extern void sysinfo_zfs(nvlist_t *);
-extern void sysinfo_disks(nvlist_t *);
-extern void sysinfo_kstat(nvlist_t *);
-extern void sysinfo_network(nvlist_t *);
+#include "sysinfo.h"
+
+typedef enum {
+	FMT_JSON,	/* compact JSON, as stored in the cache */
+	FMT_PRETTY,	/* indented JSON */
+	FMT_PROM	/* Prometheus text exposition format */
+} format_t;
 
 static struct {
 	boolean_t opt_f; /* -f, force cache update */
 	boolean_t opt_u; /* -u, update cache silently */
+	int opt_j; /* -j <n>, number of collector threads */
+	boolean_t opt_T; /* -T, print timing information to stderr */
+	char *opt_c; /* -c <list>, only run these collectors */
+	char *opt_k; /* -k <list>, only output these keys */
+	format_t opt_o; /* -o <format>, output format */
+	int opt_w; /* -w <secs>, print changes every <secs> seconds */
 } opts;
 
+/* keys given with -k, in the order they were given */
+static char **keys;
+static int nkeys;
+
+/* when the first byte of output was written, for -T */
+static hrtime_t first_byte;
+
 void usage(FILE *f) {
-	fprintf(f, "Usage: sysinfo [-fhu]\n");
+	fprintf(f, "Usage: sysinfo [-fhTu] [-c collectors] [-j threads] [-k keys] "
+	    "[-o format]\n");
+	fprintf(f, "       sysinfo -w secs [-c collectors] [-j threads] "
+	    "[-k keys]\n");
 	fprintf(f, "\n");
 	fprintf(f, "Options\n");
+	fprintf(f, "  -c <list> only run these collectors (comma separated)\n");
 	fprintf(f, "  -f        force a cache update and output data\n");
 	fprintf(f, "  -h        print this message and exit\n");
+	fprintf(f, "  -j <n>    run the collectors on <n> threads\n");
+	fprintf(f, "  -k <list> only output these keys (comma separated)\n");
+	fprintf(f, "  -o <fmt>  output format: json (default), pretty or prom\n");
+	fprintf(f, "  -T        print startup, per-collector and output timings (usecs)\n");
+	fprintf(f, "            to stderr\n");
 	fprintf(f, "  -u        force a cache update and output nothing\n");
+	fprintf(f, "  -w <secs> print the document, then every <secs> seconds "
+	    "a line of\n");
+	fprintf(f, "            JSON with the keys that were added, removed or "
+	    "changed\n");
+}
+
+/*
+ * build the set of collectors to run from the -c and -k lists.  the lists
+ * are split in place; the -k keys are kept in "keys" so the output can be
+ * cut down to just those afterwards
+ */
+static boolean_t *
+select_collectors(void)
+{
+	boolean_t *want;
+	char *name, *lasts;
+	int i;
+
+	if ((want = calloc(sysinfo_collector_count(),
+	    sizeof (boolean_t))) == NULL)
+		err(1, "calloc");
+
+	if (opts.opt_c != NULL) {
+		for (name = strtok_r(opts.opt_c, ",", &lasts); name != NULL;
+		    name = strtok_r(NULL, ",", &lasts)) {
+			if ((i = sysinfo_collector_lookup(name)) < 0)
+				errx(1, "unknown collector: %s", name);
+			want[i] = B_TRUE;
+		}
+	}
+
+	if (opts.opt_k != NULL) {
+		// a list of n bytes holds at most n / 2 + 1 keys
+		if ((keys = calloc(strlen(opts.opt_k) / 2 + 1,
+		    sizeof (char *))) == NULL)
+			err(1, "calloc");
+		for (name = strtok_r(opts.opt_k, ",", &lasts); name != NULL;
+		    name = strtok_r(NULL, ",", &lasts)) {
+			// "VM Capable" is added by sysinfo_gather itself
+			i = sysinfo_key_lookup(name);
+			if (i < 0 && strcmp(name, "VM Capable") != 0)
+				errx(1, "unknown key: %s", name);
+			if (i >= 0)
+				want[i] = B_TRUE;
+			keys[nkeys++] = name;
+		}
+		if (nkeys == 0)
+			errx(1, "no keys given with -k");
+	}
+
+	return (want);
+}
+
+/*
+ * how long the process ran before main(), from its start time in psinfo
+ * to "now" (the wall clock time main() was entered).  this is mostly the
+ * runtime linker mapping and relocating the libraries that aren't lazily
+ * loaded.  returns -1 if it can't be told
+ */
+static hrtime_t
+startup_time(const struct timespec *now)
+{
+	psinfo_t psinfo;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open("/proc/self/psinfo", O_RDONLY)) < 0)
+		return (-1);
+	n = read(fd, &psinfo, sizeof (psinfo));
+	(void) close(fd);
+	if (n != sizeof (psinfo))
+		return (-1);
+
+	return ((now->tv_sec - psinfo.pr_start.tv_sec) * NANOSEC +
+	    (now->tv_nsec - psinfo.pr_start.tv_nsec));
+}
+
+/*
+ * print the timings gathered with -T as a single line of JSON on stderr,
+ * wrapped in a "_timing" object so it can be told apart in collected logs.
+ * "startup" is the time before main(), "first byte" the time from main()
+ * until the output started (on a cache hit, nearly all of the run) and
+ * "total" the time spent in main()
+ */
+static void
+print_timing(nvlist_t *timing, hrtime_t start, const struct timespec *now)
+{
+	sysinfo_buf_t buf;
+	sysinfo_json_t j;
+	hrtime_t t;
+
+	if ((t = startup_time(now)) >= 0)
+		sysinfo_timing_add(timing, "startup", t);
+	if (first_byte != 0)
+		sysinfo_timing_add(timing, "first byte", first_byte - start);
+	sysinfo_timing_add(timing, "total", gethrtime() - start);
+
+	sysinfo_buf_init(&buf);
+	sysinfo_json_init(&j, &buf, B_FALSE);
+	sysinfo_json_begin_object(&j);
+	sysinfo_json_key(&j, "_timing");
+	sysinfo_json_nvlist(&j, timing);
+	sysinfo_json_end_object(&j);
+	sysinfo_buf_append(&buf, "\n", 1);
+	if (!buf.sb_error)
+		(void) sysinfo_write_all(STDERR_FILENO, buf.sb_data, buf.sb_len);
+	sysinfo_buf_free(&buf);
+}
+
+/*
+ * write a compact JSON document to stdout in the format selected with -o.
+ * -o prom output is rendered from the nvlist and written as it is
+ */
+static int
+output(const char *json, size_t len)
+{
+	sysinfo_buf_t buf;
+	sysinfo_json_t j;
+	int ret = -1;
+
+	if (opts.opt_o != FMT_PRETTY) {
+		if (first_byte == 0)
+			first_byte = gethrtime();
+		return (sysinfo_write_all(STDOUT_FILENO, json, len));
+	}
+
+	sysinfo_buf_init(&buf);
+	sysinfo_json_init(&j, &buf, B_TRUE);
+	sysinfo_json_reformat(&j, json, len);
+	sysinfo_buf_append(&buf, "\n", 1);
+	if (!buf.sb_error) {
+		if (first_byte == 0)
+			first_byte = gethrtime();
+		ret = sysinfo_write_all(STDOUT_FILENO, buf.sb_data, buf.sb_len);
+	}
+	sysinfo_buf_free(&buf);
+	return (ret);
+}
+
+/*
+ * render "nvl" as a single line of compact JSON and write it to stdout
+ */
+static int
+emit(nvlist_t *nvl)
+{
+	sysinfo_buf_t buf;
+	sysinfo_json_t j;
+	int ret = -1;
+
+	sysinfo_buf_init(&buf);
+	sysinfo_json_init(&j, &buf, B_FALSE);
+	sysinfo_json_nvlist(&j, nvl);
+	sysinfo_buf_append(&buf, "\n", 1);
+	if (!buf.sb_error)
+		ret = sysinfo_write_all(STDOUT_FILENO, buf.sb_data, buf.sb_len);
+	sysinfo_buf_free(&buf);
+	return (ret);
+}
+
+/*
+ * two values are the same if they render to the same JSON, which is how a
+ * consumer of the output would compare them
+ */
+static boolean_t
+pair_equal(nvpair_t *a, nvpair_t *b)
+{
+	sysinfo_buf_t abuf, bbuf;
+	sysinfo_json_t j;
+	nvlist_t *nvl;
+	boolean_t eq;
+
+	if (nvpair_type(a) != nvpair_type(b))
+		return (B_FALSE);
+
+	sysinfo_buf_init(&abuf);
+	sysinfo_buf_init(&bbuf);
+
+	nvl = fnvlist_alloc();
+	fnvlist_add_nvpair(nvl, a);
+	sysinfo_json_init(&j, &abuf, B_FALSE);
+	sysinfo_json_nvlist(&j, nvl);
+	nvlist_free(nvl);
+
+	nvl = fnvlist_alloc();
+	fnvlist_add_nvpair(nvl, b);
+	sysinfo_json_init(&j, &bbuf, B_FALSE);
+	sysinfo_json_nvlist(&j, nvl);
+	nvlist_free(nvl);
+
+	eq = !abuf.sb_error && !bbuf.sb_error && abuf.sb_len == bbuf.sb_len &&
+	    memcmp(abuf.sb_data, bbuf.sb_data, abuf.sb_len) == 0;
+
+	sysinfo_buf_free(&abuf);
+	sysinfo_buf_free(&bbuf);
+	return (eq);
+}
+
+/*
+ * the top-level keys that differ between "old" and "new", as
+ *
+ *   {"added": {...}, "removed": [...], "changed": {...}}
+ *
+ * where "added" and "changed" hold the new values.  returns NULL if the
+ * documents are the same.
+ * must be free()d by caller
+ */
+static nvlist_t *
+diff(nvlist_t *old, nvlist_t *new)
+{
+	nvlist_t *delta = NULL;
+	nvlist_t *added, *changed;
+	nvpair_t *curr, *pair;
+	char **removed;
+	uint_t nremoved = 0, n = 0;
+
+	for (curr = nvlist_next_nvpair(old, NULL); curr != NULL;
+	    curr = nvlist_next_nvpair(old, curr))
+		n++;
+	if ((removed = calloc(n + 1, sizeof (char *))) == NULL) {
+		warn("calloc");
+		return (NULL);
+	}
+
+	added = fnvlist_alloc();
+	changed = fnvlist_alloc();
+
+	for (curr = nvlist_next_nvpair(new, NULL); curr != NULL;
+	    curr = nvlist_next_nvpair(new, curr)) {
+		if (nvlist_lookup_nvpair(old, nvpair_name(curr), &pair) != 0)
+			fnvlist_add_nvpair(added, curr);
+		else if (!pair_equal(pair, curr))
+			fnvlist_add_nvpair(changed, curr);
+	}
+	for (curr = nvlist_next_nvpair(old, NULL); curr != NULL;
+	    curr = nvlist_next_nvpair(old, curr)) {
+		if (!nvlist_exists(new, nvpair_name(curr)))
+			removed[nremoved++] = nvpair_name(curr);
+	}
+
+	if (nremoved > 0 || !nvlist_empty(added) || !nvlist_empty(changed)) {
+		delta = fnvlist_alloc();
+		fnvlist_add_nvlist(delta, "added", added);
+		fnvlist_add_string_array(delta, "removed", removed, nremoved);
+		fnvlist_add_nvlist(delta, "changed", changed);
+	}
+
+	nvlist_free(added);
+	nvlist_free(changed);
+	free(removed);
+	return (delta);
+}
+
+/*
+ * -w: print the whole document once, then every opts.opt_w seconds a
+ * delta against the previous one, if anything changed.  the context (and
+ * with it the kstat, dladm and libzfs handles) stays open throughout, and
+ * only the collectors whose output can change before a reboot are re-run.
+ * runs until stdout goes away
+ */
+static int
+watch(sysinfo_ctx_t *ctx, const boolean_t *want)
+{
+	nvlist_t *sections, *doc, *sel, *delta;
+	nvlist_t *prev = NULL;
+	boolean_t *rerun;
+	int i, n = sysinfo_collector_count();
+	int ret = 1;
+
+	if ((rerun = calloc(n, sizeof (boolean_t))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++)
+		rerun[i] = (want == NULL || want[i]) &&
+		    !sysinfo_collectors[i].co_boot;
+
+	if ((sections = sysinfo_gather_sections(ctx, opts.opt_j, want,
+	    NULL)) == NULL)
+		goto done;
+
+	for (;;) {
+		if ((doc = sysinfo_assemble(sections, NULL)) == NULL)
+			goto done;
+		if (nkeys > 0) {
+			sel = sysinfo_select_keys(doc, keys, nkeys);
+			nvlist_free(doc);
+			doc = sel;
+		}
+
+		if (prev == NULL) {
+			if (emit(doc) != 0)
+				break;
+		} else if ((delta = diff(prev, doc)) != NULL) {
+			i = emit(delta);
+			nvlist_free(delta);
+			if (i != 0)
+				break;
+		}
+		nvlist_free(prev);
+		prev = doc;
+
+		(void) sleep(opts.opt_w);
+
+		sysinfo_ctx_refresh(ctx);
+		if (sysinfo_refresh_sections(ctx, sections, opts.opt_j, rerun,
+		    NULL) != 0)
+			warnx("refresh failed, keeping previous data");
+	}
+	ret = 0;
+
+done:
+	nvlist_free(prev);
+	nvlist_free(sections);
+	free(rerun);
+	return (ret);
+}
+
+/*
+ * ask a running sysinfod for the document, or for the -k keys.  returns 0
+ * if the reply was printed, -1 if the caller should gather in-process
+ */
+static int
+from_daemon(void)
+{
+	sysinfo_buf_t req, reply;
+	int ret = -1;
+	int i;
+
+	sysinfo_buf_init(&req);
+	sysinfo_buf_init(&reply);
+	for (i = 0; i < nkeys; i++) {
+		if (i > 0)
+			sysinfo_buf_append(&req, ",", 1);
+		sysinfo_buf_puts(&req, keys[i]);
+	}
+
+	if (!req.sb_error &&
+	    sysinfo_client_fetch(nkeys > 0 ? req.sb_data : NULL, &reply) == 0) {
+		if (output(reply.sb_data, reply.sb_len) != 0)
+			warn("write");
+		ret = 0;
+	}
+
+	sysinfo_buf_free(&req);
+	sysinfo_buf_free(&reply);
+	return (ret);
 }
 
 int main(int argc, char **argv) {
 	nvlist_t *nvl;
-	int opt;
+	nvlist_t *sections = NULL;
+	nvlist_t *timing = NULL;
+	sysinfo_ctx_t *ctx;
+	boolean_t *want = NULL;
+	boolean_t *stale;
+	uint64_t *stamps;
+	int opt, n;
+	int ret = 0;
+	boolean_t cached = B_FALSE;
+	boolean_t fresh = B_FALSE;
+	int lockfd = -1;
+	sysinfo_cache_t cache;
+	sysinfo_buf_t buf;
+	sysinfo_buf_t prom;
+	sysinfo_json_t j;
+	hrtime_t start = gethrtime();
+	hrtime_t t;
+	struct timespec now;
+
+	(void) clock_gettime(CLOCK_REALTIME, &now);
 
 	opts.opt_f = B_FALSE;
 	opts.opt_u = B_FALSE;
-	while ((opt = getopt(argc, argv, "fhu")) != -1) {
+	opts.opt_j = 1;
+	opts.opt_T = B_FALSE;
+	opts.opt_c = NULL;
+	opts.opt_k = NULL;
+	opts.opt_o = FMT_JSON;
+	opts.opt_w = 0;
+	while ((opt = getopt(argc, argv, "c:fhj:k:o:Tuw:")) != -1) {
 		switch (opt) {
+		case 'c':
+			opts.opt_c = optarg;
+			break;
 		case 'f':
 			opts.opt_f = B_TRUE;
 			break;
 		case 'h':
 			usage(stdout);
 			return (0);
+		case 'j':
+			if ((opts.opt_j = sysinfo_parse_count(optarg)) < 0)
+				errx(1, "invalid thread count: %s", optarg);
+			break;
+		case 'k':
+			opts.opt_k = optarg;
+			break;
+		case 'o':
+			if (strcmp(optarg, "json") == 0)
+				opts.opt_o = FMT_JSON;
+			else if (strcmp(optarg, "pretty") == 0)
+				opts.opt_o = FMT_PRETTY;
+			else if (strcmp(optarg, "prom") == 0)
+				opts.opt_o = FMT_PROM;
+			else
+				errx(1, "unknown output format: %s", optarg);
+			break;
+		case 'T':
+			opts.opt_T = B_TRUE;
+			break;
 		case 'u':
 			opts.opt_u = B_TRUE;
 			break;
+		case 'w':
+			if ((opts.opt_w = sysinfo_parse_count(optarg)) < 0)
+				errx(1, "invalid interval: %s", optarg);
+			break;
 		default:
 			usage(stderr);
 			return (1);
 		}
 	}
 
-	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0) {
-		warn("nvlist_alloc");
+	/*
+	 * a partial document is never read from or written to the cache
+	 */
+	if (opts.opt_c != NULL || opts.opt_k != NULL) {
+		if (opts.opt_u)
+			errx(1, "-u cannot be used with -c or -k");
+		want = select_collectors();
+	}
+
+	/*
+	 * watch mode streams newline-delimited JSON from its own long-lived
+	 * context, bypassing the daemon and the cache
+	 */
+	if (opts.opt_w > 0) {
+		if (opts.opt_f || opts.opt_u || opts.opt_T ||
+		    opts.opt_o != FMT_JSON)
+			errx(1, "-w cannot be used with -f, -o, -T or -u");
+		if ((ctx = sysinfo_ctx_create(B_TRUE)) == NULL)
+			return (1);
+		ret = watch(ctx, want);
+		sysinfo_ctx_destroy(ctx);
+		free(want);
+		free(keys);
+		return (ret);
+	}
+
+	/* -o prom reports the collector times even without -T */
+	if (opts.opt_T || opts.opt_o == FMT_PROM)
+		timing = fnvlist_alloc();
+
+	/*
+	 * a running sysinfod can answer anything but -c, -f and -u.  its reply
+	 * is JSON, so -o prom, which is rendered from the nvlist, gathers here
+	 */
+	if (opts.opt_c == NULL && !opts.opt_f && !opts.opt_u &&
+	    opts.opt_o != FMT_PROM && from_daemon() == 0) {
+		if (timing != NULL) {
+			print_timing(timing, start, &now);
+			nvlist_free(timing);
+		}
+		free(want);
+		free(keys);
+		return (0);
+	}
+
+	n = sysinfo_collector_count();
+	if ((stamps = calloc(n, sizeof (uint64_t))) == NULL ||
+	    (stale = calloc(n, sizeof (boolean_t))) == NULL)
+		err(1, "calloc");
+
+	/*
+	 * the inputs are fingerprinted before anything is gathered, so a
+	 * change made while gathering is caught by the next run
+	 */
+	sysinfo_stamps(stamps);
+
+	if ((ctx = sysinfo_ctx_create(B_TRUE)) == NULL)
 		return 1;
+
+	/* -f and -u re-run the boot-scoped collectors too */
+	if (opts.opt_f || opts.opt_u)
+		sysinfo_ctx_boot_discard(ctx);
+
+	/*
+	 * serve the cached document unless asked to regather.  if only some
+	 * collectors' inputs have moved, just those are re-run and spliced
+	 * into the cached sections.  -o prom needs the document as an nvlist,
+	 * so it assembles one from the cached sections instead.
+	 *
+	 * runs that find the cache out of date at the same time (at boot, or
+	 * when several services start at once) are coalesced: the first takes
+	 * the gather lock and rewrites the cache, and the rest wait for it and
+	 * then look at the cache again.  a leader that dies drops the lock and
+	 * the next run to get it gathers instead; one that hangs is given
+	 * SYSINFO_LOCK_TIMEOUT seconds before the waiters gather without it
+	 */
+	if (want == NULL && !opts.opt_f && !opts.opt_u) {
+		if ((cached = sysinfo_cache_open(&cache) == 0))
+			fresh = sysinfo_cache_stale(&cache, stamps, stale) == 0;
+		if (!fresh) {
+			if (cached)
+				sysinfo_cache_close(&cache);
+			lockfd = sysinfo_cache_lock(SYSINFO_LOCK_TIMEOUT);
+			if ((cached = sysinfo_cache_open(&cache) == 0))
+				fresh = sysinfo_cache_stale(&cache, stamps,
+				    stale) == 0;
+			// the leader left a good cache, there's nothing to lead
+			if (fresh) {
+				sysinfo_cache_unlock(lockfd);
+				lockfd = -1;
+			}
+		}
+	} else if (want == NULL) {
+		// -f and -u gather regardless, but lead any run that arrives
+		lockfd = sysinfo_cache_lock(0);
 	}
 
-	// XXX this is hardcoded to be true for some reason
-	fnvlist_add_boolean(nvl, "VM Capable");
+	if (cached) {
+		if (fresh && opts.opt_o != FMT_PROM) {
+			if (output(cache.sc_json, cache.sc_jsonlen) != 0) {
+				warn("write");
+				ret = 1;
+			}
+			sysinfo_cache_close(&cache);
+			sysinfo_cache_unlock(lockfd);
+			sysinfo_ctx_destroy(ctx);
+			if (timing != NULL) {
+				print_timing(timing, start, &now);
+				nvlist_free(timing);
+			}
+			free(stamps);
+			free(stale);
+			return (ret);
+		}
 
-	sysinfo_bootparams(nvl);
-	sysinfo_uname(nvl);
-	sysinfo_smartdc(nvl);
-	sysinfo_smbios(nvl);
-	sysinfo_uptime(nvl);
-	sysinfo_sysconf(nvl);
-	sysinfo_zfs(nvl);
-	sysinfo_disks(nvl);
-	sysinfo_kstat(nvl);
-	sysinfo_network(nvl);
+		sections = sysinfo_cache_sections(&cache);
+		sysinfo_cache_close(&cache);
+		if (sections != NULL && !fresh && sysinfo_refresh_sections(ctx,
+		    sections, opts.opt_j, stale, timing) != 0) {
+			nvlist_free(sections);
+			sections = NULL;
+		}
+		if (sections == NULL)
+			fresh = B_FALSE;
+	}
 
-	nvlist_print_json(stdout, nvl);
-	printf("\n");
-	//nvlist_print(stdout, nvl);
+	if (sections == NULL &&
+	    (sections = sysinfo_gather_sections(ctx, opts.opt_j, want,
+	    timing)) == NULL)
+		return 1;
+
+	/* every handle a collector opened is closed here, once */
+	sysinfo_ctx_destroy(ctx);
 
+	if ((nvl = sysinfo_assemble(sections, timing)) == NULL)
+		return 1;
+
+	if (nkeys > 0) {
+		nvlist_t *sel = sysinfo_select_keys(nvl, keys, nkeys);
+		nvlist_free(nvl);
+		nvl = sel;
+	}
+
+	/*
+	 * render once as compact JSON, then feed both the cache and stdout
+	 * from that buffer.  -o prom is written from the nvlist, and only
+	 * needs the JSON if the cache is being rewritten
+	 */
+	t = gethrtime();
+	sysinfo_buf_init(&buf);
+	sysinfo_buf_init(&prom);
+	if (opts.opt_o != FMT_PROM || (want == NULL && !fresh)) {
+		sysinfo_json_init(&j, &buf, B_FALSE);
+		sysinfo_json_nvlist(&j, nvl);
+		sysinfo_buf_append(&buf, "\n", 1);
+	}
+	if (opts.opt_o == FMT_PROM)
+		sysinfo_prom(&prom, nvl, timing);
 	nvlist_free(nvl);
-	return 0;
+	if (buf.sb_error || prom.sb_error) {
+		sysinfo_buf_free(&buf);
+		sysinfo_buf_free(&prom);
+		return 1;
+	}
+	sysinfo_timing_add(timing, "render", gethrtime() - t);
+
+	if (want == NULL && !fresh) {
+		t = gethrtime();
+		(void) sysinfo_cache_write(stamps, sections, buf.sb_data,
+		    buf.sb_len, NULL);
+		sysinfo_timing_add(timing, "cache", gethrtime() - t);
+	}
+	sysinfo_cache_unlock(lockfd);
+	nvlist_free(sections);
+
+	t = gethrtime();
+	if (opts.opt_o == FMT_PROM) {
+		if (!opts.opt_u && output(prom.sb_data, prom.sb_len) != 0) {
+			warn("write");
+			ret = 1;
+		}
+	} else if (!opts.opt_u && output(buf.sb_data, buf.sb_len) != 0) {
+		warn("write");
+		ret = 1;
+	}
+	sysinfo_timing_add(timing, "output", gethrtime() - t);
+
+	if (opts.opt_T)
+		print_timing(timing, start, &now);
+	nvlist_free(timing);
+
+	sysinfo_buf_free(&buf);
+	sysinfo_buf_free(&prom);
+	free(want);
+	free(keys);
+	free(stamps);
+	free(stale);
+	return (ret);
 }
@@ -0,0 +1,331 @@
+#ifndef sysinfo_h__
+#define sysinfo_h__
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <libnvpair.h>
+
+/*
+ * sysinfo_ctx.c
+ *
+ * platform handles shared by the collectors.  each handle is opened on
+ * first use and closed by sysinfo_ctx_destroy.  the kstat handle must be
+ * released after use since libkstat handles can't be used from two threads
+ * at once; the others may be used concurrently.  the accessors return NULL
+ * if the handle can't be opened
+ */
+struct kstat_ctl;
+struct dladm_handle;
+struct libzfs_handle;
+struct di_node;
+
+typedef struct sysinfo_ctx sysinfo_ctx_t;
+
+/*
+ * with "save_boot" false, gathers with the context still use the boot
+ * snapshot but never write it (for the library, whose callers needn't be
+ * root)
+ */
+extern sysinfo_ctx_t *sysinfo_ctx_create(boolean_t save_boot);
+extern void sysinfo_ctx_destroy(sysinfo_ctx_t *);
+extern void sysinfo_ctx_refresh(sysinfo_ctx_t *);
+extern struct kstat_ctl *sysinfo_ctx_kstat_hold(sysinfo_ctx_t *);
+extern void sysinfo_ctx_kstat_rele(sysinfo_ctx_t *);
+extern struct dladm_handle *sysinfo_ctx_dladm(sysinfo_ctx_t *);
+extern struct libzfs_handle *sysinfo_ctx_zfs(sysinfo_ctx_t *);
+extern struct di_node *sysinfo_ctx_devinfo(sysinfo_ctx_t *);
+
+/*
+ * the boot snapshot: sections of the collectors marked co_boot, kept
+ * for the rest of the boot so those collectors only run once per boot.
+ * sysinfo_ctx_boot returns the sections saved earlier in this boot (NULL
+ * if there are none), sysinfo_ctx_boot_discard forgets them so the
+ * collectors run again, sysinfo_ctx_boot_add records a freshly gathered
+ * section and sysinfo_ctx_boot_sync saves what was added.  these are only
+ * for the thread running the gather
+ */
+extern nvlist_t *sysinfo_ctx_boot(sysinfo_ctx_t *);
+extern void sysinfo_ctx_boot_discard(sysinfo_ctx_t *);
+extern void sysinfo_ctx_boot_add(sysinfo_ctx_t *, const char *, nvlist_t *);
+extern void sysinfo_ctx_boot_sync(sysinfo_ctx_t *);
+
+/*
+ * a collector fills the given nvlist with the top-level keys it is
+ * responsible for, using the handles in the context
+ */
+typedef void (*sysinfo_func_t)(sysinfo_ctx_t *, nvlist_t *);
+
+/*
+ * a cheap fingerprint of some input of a collector that stat(2) can't see
+ */
+typedef uint64_t (*sysinfo_stamp_t)(void);
+
+typedef struct sysinfo_collector {
+	const char *co_name;
+	sysinfo_func_t co_func;
+	const char **co_keys;	/* top-level keys produced, NULL terminated */
+	const char **co_inputs;	/* files the output depends on, or NULL */
+	sysinfo_stamp_t co_stamp; /* other inputs, or NULL */
+	boolean_t co_boot;	/* output is fixed until the next reboot */
+} sysinfo_collector_t;
+
+/*
+ * every collector in output order, terminated by an entry with a NULL name
+ */
+extern sysinfo_collector_t sysinfo_collectors[];
+
+/* collectors, included at compile time */
+extern void sysinfo_bootparams(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_uname(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_image(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_smartdc(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_smbios(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_uptime(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_sysconf(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_zfs(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_disks(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_kstat(sysinfo_ctx_t *, nvlist_t *);
+extern void sysinfo_network(sysinfo_ctx_t *, nvlist_t *);
+
+extern uint64_t sysinfo_uname_stamp(void);
+
+/*
+ * number of entries in sysinfo_collectors, and the index of the collector
+ * with the given name or that produces the given top-level key (-1 if there
+ * is none)
+ */
+extern int sysinfo_collector_count(void);
+extern int sysinfo_collector_lookup(const char *name);
+extern int sysinfo_key_lookup(const char *key);
+
+/*
+ * fingerprint the declared inputs of collector "i", or of every collector
+ * into "stamps" (indexed like sysinfo_collectors).  a collector with no
+ * declared inputs always has a stamp of 0.  when a stamp differs from the
+ * one recorded at the last gather the collector's section is out of date
+ */
+extern uint64_t sysinfo_collector_stamp(int i);
+extern void sysinfo_stamps(uint64_t *stamps);
+
+/*
+ * a positive count given to an option such as -j, or -1 if "s" isn't one
+ */
+extern int sysinfo_parse_count(const char *s);
+
+/*
+ * run the selected collectors ("want", indexed like sysinfo_collectors;
+ * NULL for all) and return an nvlist mapping each collector name to the
+ * nvlist it produced.
+ * must be free()d by caller
+ */
+extern nvlist_t *sysinfo_gather_sections(sysinfo_ctx_t *ctx, int nthreads,
+    const boolean_t *want, nvlist_t *timing);
+
+/*
+ * re-run the collectors in "stale" and replace their entries in "sections"
+ */
+extern int sysinfo_refresh_sections(sysinfo_ctx_t *ctx, nvlist_t *sections,
+    int nthreads, const boolean_t *stale, nvlist_t *timing);
+
+/*
+ * build the document from a sections list, merging the sections in table
+ * order so the output doesn't depend on the order they were gathered in.
+ * must be free()d by caller
+ */
+extern nvlist_t *sysinfo_assemble(nvlist_t *sections, nvlist_t *timing);
+
+/*
+ * run the collectors and return the merged document, or NULL on error.
+ * "want" is indexed like sysinfo_collectors and selects which collectors
+ * run; NULL runs all of them.
+ * with "nthreads" greater than 1 the collectors run concurrently on that
+ * many worker threads; the output is the same either way.
+ * if "timing" is not NULL the time spent in each collector, in the whole
+ * gather and in merging the results is added to it in microseconds.
+ * must be free()d by caller
+ */
+extern nvlist_t *sysinfo_gather(sysinfo_ctx_t *ctx, int nthreads,
+    const boolean_t *want, nvlist_t *timing);
+
+/*
+ * return a new nvlist holding only "keys" from "nvl", in the order given.
+ * keys that aren't present are skipped.
+ * must be free()d by caller
+ */
+extern nvlist_t *sysinfo_select_keys(nvlist_t *nvl, char **keys, int nkeys);
+
+/*
+ * add an elapsed time "t" to "timing" as "name", in microseconds.  does
+ * nothing if "timing" is NULL
+ */
+extern void sysinfo_timing_add(nvlist_t *timing, const char *name,
+    hrtime_t t);
+
+/* sysinfo_json.c */
+typedef struct sysinfo_buf {
+	char *sb_data;
+	size_t sb_len;
+	size_t sb_size;
+	boolean_t sb_error;	/* an allocation failed, contents are short */
+} sysinfo_buf_t;
+
+extern void sysinfo_buf_init(sysinfo_buf_t *);
+extern void sysinfo_buf_free(sysinfo_buf_t *);
+extern void sysinfo_buf_append(sysinfo_buf_t *, const char *, size_t);
+extern void sysinfo_buf_puts(sysinfo_buf_t *, const char *);
+
+/*
+ * streaming JSON writer.  keys and values are appended to a sysinfo_buf_t
+ * as they are written, either compact (the same as nvlist_print_json) or
+ * indented for humans
+ */
+typedef struct sysinfo_json {
+	sysinfo_buf_t *sj_buf;
+	boolean_t sj_pretty;
+	int sj_depth;
+	boolean_t sj_first;	/* nothing written yet at this depth */
+	boolean_t sj_key;	/* a key was just written */
+} sysinfo_json_t;
+
+extern void sysinfo_json_init(sysinfo_json_t *, sysinfo_buf_t *, boolean_t);
+extern void sysinfo_json_begin_object(sysinfo_json_t *);
+extern void sysinfo_json_end_object(sysinfo_json_t *);
+extern void sysinfo_json_begin_array(sysinfo_json_t *);
+extern void sysinfo_json_end_array(sysinfo_json_t *);
+extern void sysinfo_json_key(sysinfo_json_t *, const char *);
+extern void sysinfo_json_string(sysinfo_json_t *, const char *);
+extern void sysinfo_json_raw(sysinfo_json_t *, const char *, size_t);
+extern void sysinfo_json_int(sysinfo_json_t *, int64_t);
+extern void sysinfo_json_uint(sysinfo_json_t *, uint64_t);
+extern void sysinfo_json_double(sysinfo_json_t *, double);
+extern void sysinfo_json_bool(sysinfo_json_t *, boolean_t);
+extern void sysinfo_json_nvlist(sysinfo_json_t *, nvlist_t *);
+extern void sysinfo_json_reformat(sysinfo_json_t *, const char *, size_t);
+
+/*
+ * sysinfo_prom.c
+ *
+ * append "doc" to "b" in the Prometheus text exposition format.  if
+ * "timing" is not NULL the collectors' times in it are included too
+ */
+extern void sysinfo_prom(sysinfo_buf_t *b, nvlist_t *doc, nvlist_t *timing);
+
+/*
+ * sysinfo_boot.c
+ *
+ * the boot time from the kernel (0 if it can't be read), and the on-disk
+ * boot snapshot for that boot time.  sysinfo_boot_read returns NULL if
+ * there is no snapshot for "boot_time".
+ * must be free()d by caller
+ */
+extern uint64_t sysinfo_boot_time(sysinfo_ctx_t *);
+extern nvlist_t *sysinfo_boot_read(uint64_t boot_time);
+extern int sysinfo_boot_write(uint64_t boot_time, nvlist_t *sections);
+
+/* sysinfo_cache.c */
+#define SYSINFO_FNV_INIT	0xcbf29ce484222325ULL
+
+/*
+ * FNV-1a of "len" bytes at "buf", continuing from "h"
+ */
+extern uint64_t sysinfo_fnv(const void *buf, size_t len, uint64_t h);
+
+extern int sysinfo_write_all(int, const char *, size_t);
+
+/*
+ * files root reads back (the cache, the boot snapshot) are written to a
+ * temp file from sysinfo_tmpfile and renamed into place, and only trusted
+ * if sysinfo_trusted says root wrote them
+ */
+extern int sysinfo_tmpfile(const char *path, char *tmp, size_t len);
+extern boolean_t sysinfo_trusted(const struct stat *);
+
+/*
+ * a mapped and validated cache file.  sc_json points at the cached JSON
+ * inside the mapping, sc_stamps at the input stamps each section was
+ * gathered with and sc_nv at the packed sections list.  sc_cksum tells one
+ * version of the file from another
+ */
+typedef struct sysinfo_cache_stamp {
+	char scs_name[16];
+	uint64_t scs_stamp;
+} sysinfo_cache_stamp_t;
+
+typedef struct sysinfo_cache {
+	void *sc_addr;
+	size_t sc_size;
+	const sysinfo_cache_stamp_t *sc_stamps;
+	uint32_t sc_nstamps;
+	char *sc_nv;
+	size_t sc_nvlen;
+	const char *sc_json;
+	size_t sc_jsonlen;
+	uint64_t sc_cksum;
+} sysinfo_cache_t;
+
+extern int sysinfo_cache_open(sysinfo_cache_t *);
+extern void sysinfo_cache_close(sysinfo_cache_t *);
+
+/*
+ * compare the stamps recorded in the cache with "stamps" and mark every
+ * collector whose inputs have moved in "stale".  returns the number of
+ * stale collectors
+ */
+extern int sysinfo_cache_stale(const sysinfo_cache_t *, const uint64_t *stamps,
+    boolean_t *stale);
+
+/*
+ * copy the stamps recorded in the cache into "stamps", indexed like
+ * sysinfo_collectors.  a collector the cache has no stamp for gets 0
+ */
+extern void sysinfo_cache_stamps(const sysinfo_cache_t *, uint64_t *stamps);
+
+/*
+ * unpack the sections list stored in the cache.
+ * must be free()d by caller
+ */
+extern nvlist_t *sysinfo_cache_sections(const sysinfo_cache_t *);
+
+/*
+ * atomically replace the cache with a new document, the sections it was
+ * assembled from and the input stamps taken before they were gathered.
+ * if "cksump" is not NULL the new file's sc_cksum is stored there
+ */
+extern int sysinfo_cache_write(const uint64_t *stamps, nvlist_t *sections,
+    const char *json, size_t len, uint64_t *cksump);
+
+/*
+ * the gather lock coalesces concurrent runs that find the cache out of
+ * date: one takes it, gathers and rewrites the cache, and the rest wait in
+ * sysinfo_cache_lock and then read what it wrote.  returns a descriptor
+ * for sysinfo_cache_unlock, or -1 if the lock wasn't taken within
+ * "timeout" seconds (0 to not wait), in which case the caller gathers
+ * without it
+ */
+#define SYSINFO_LOCK_TIMEOUT	30
+
+extern int sysinfo_cache_lock(int timeout);
+extern void sysinfo_cache_unlock(int fd);
+
+/*
+ * sysinfo_client.c
+ *
+ * sysinfod listens on SYSINFOD_SOCKET.  a request is a single line holding
+ * a comma-separated list of keys, or an empty line for the whole document.
+ * the reply is the compact JSON document followed by a newline, after
+ * which the daemon closes the connection
+ */
+#define SYSINFOD_SOCKET		"/var/run/sysinfod.sock"
+#define SYSINFOD_MAXREQ		4096
+#define SYSINFOD_TIMEOUT	2	/* seconds a client waits for a reply */
+
+/*
+ * ask a running sysinfod for "keys" (NULL or empty for everything) and
+ * append the reply to "out".  returns -1 if the daemon isn't running, is
+ * too slow to answer or the reply is incomplete, in which case the caller
+ * should gather itself
+ */
+extern int sysinfo_client_fetch(const char *keys, sysinfo_buf_t *out);
+
+#endif // sysinfo_h__
@@ -0,0 +1,152 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <kstat.h>
+#include <sys/stat.h>
+
+#include <libnvpair.h>
+
+#include "sysinfo.h"
+
+/*
+ * the boot snapshot holds the sections of the collectors whose output
+ * can't change without a reboot (co_boot), as a packed nvlist of
+ *
+ *   - "version", so a file from another version of this program is ignored
+ *   - "boot_time", the boot it was taken in
+ *   - "sections", mapping collector name to the nvlist it produced
+ *
+ * a snapshot from an earlier boot is ignored and replaced.  /var/run doesn't
+ * survive a reboot anyway, but the boot time keeps a stale file from being
+ * trusted if it does.  like the cache, it is only read if root wrote it
+ */
+#define SYSINFO_BOOT		"/var/run/sysinfo.boot"
+#define SYSINFO_BOOT_VERSION	1
+
+uint64_t
+sysinfo_boot_time(sysinfo_ctx_t *ctx)
+{
+	kstat_ctl_t *kc;
+	kstat_t *ksp;
+	kstat_named_t *knp;
+	uint64_t t = 0;
+
+	if ((kc = sysinfo_ctx_kstat_hold(ctx)) == NULL)
+		return (0);
+
+	if ((ksp = kstat_lookup(kc, "unix", 0, "system_misc")) != NULL &&
+	    kstat_read(kc, ksp, NULL) != -1 &&
+	    (knp = kstat_data_lookup(ksp, "boot_time")) != NULL)
+		t = knp->value.ui32;
+
+	sysinfo_ctx_kstat_rele(ctx);
+	return (t);
+}
+
+nvlist_t *
+sysinfo_boot_read(uint64_t boot_time)
+{
+	struct stat st;
+	char *buf = NULL;
+	nvlist_t *nvl = NULL;
+	nvlist_t *sections = NULL;
+	nvlist_t *section;
+	uint64_t t;
+	uint32_t v;
+	ssize_t n;
+	size_t off = 0;
+	int fd;
+
+	if ((fd = open(SYSINFO_BOOT, O_RDONLY | O_NOFOLLOW)) < 0)
+		return (NULL);
+
+	if (fstat(fd, &st) != 0 || !sysinfo_trusted(&st) || st.st_size == 0 ||
+	    (buf = malloc(st.st_size)) == NULL)
+		goto done;
+	while (off < st.st_size) {
+		if ((n = read(fd, buf + off, st.st_size - off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			goto done;
+		}
+		if (n == 0)
+			goto done;
+		off += n;
+	}
+
+	if (nvlist_unpack(buf, off, &nvl, 0) != 0) {
+		nvl = NULL;
+		goto done;
+	}
+	if (nvlist_lookup_uint32(nvl, "version", &v) != 0 ||
+	    v != SYSINFO_BOOT_VERSION ||
+	    nvlist_lookup_uint64(nvl, "boot_time", &t) != 0 ||
+	    t != boot_time ||
+	    nvlist_lookup_nvlist(nvl, "sections", &section) != 0)
+		goto done;
+
+	sections = fnvlist_dup(section);
+
+done:
+	(void) close(fd);
+	nvlist_free(nvl);
+	free(buf);
+	return (sections);
+}
+
+/*
+ * atomically replace the snapshot, the same way as the cache
+ */
+int
+sysinfo_boot_write(uint64_t boot_time, nvlist_t *sections)
+{
+	char tmp[PATH_MAX];
+	nvlist_t *nvl;
+	char *buf = NULL;
+	size_t len = 0;
+	int fd = -1;
+	int ret = -1;
+
+	nvl = fnvlist_alloc();
+	fnvlist_add_uint32(nvl, "version", SYSINFO_BOOT_VERSION);
+	fnvlist_add_uint64(nvl, "boot_time", boot_time);
+	fnvlist_add_nvlist(nvl, "sections", sections);
+	if (nvlist_pack(nvl, &buf, &len, NV_ENCODE_NATIVE, 0) != 0) {
+		warnx("nvlist_pack failed");
+		nvlist_free(nvl);
+		return (-1);
+	}
+	nvlist_free(nvl);
+
+	if ((fd = sysinfo_tmpfile(SYSINFO_BOOT, tmp, sizeof (tmp))) < 0)
+		goto done;
+	if (sysinfo_write_all(fd, buf, len) != 0) {
+		warn("write(%s)", tmp);
+		goto done;
+	}
+	if (close(fd) != 0) {
+		fd = -1;
+		warn("close(%s)", tmp);
+		goto done;
+	}
+	fd = -1;
+
+	if (rename(tmp, SYSINFO_BOOT) != 0) {
+		warn("rename(%s, %s)", tmp, SYSINFO_BOOT);
+		goto done;
+	}
+	ret = 0;
+
+done:
+	if (fd >= 0)
+		(void) close(fd);
+	if (ret != 0)
+		(void) unlink(tmp);
+	free(buf);
+	return (ret);
+}
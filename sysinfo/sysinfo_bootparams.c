@@ -14,6 +14,8 @@
 
 #include <libnvpair.h>
 
+#include "sysinfo.h"
+
 /*
  * In this comment typed properties are those of type DI_PROP_TYPE_UNDEF_IT,
  * DI_PROP_TYPE_BOOLEAN, DI_PROP_TYPE_INT, DI_PROP_TYPE_INT64,
@@ -103,52 +105,87 @@ static int prop_type_guess(di_prop_t prop, void **prop_data, int *prop_type) {
     return (len);
 }
 
+/*
+ * add a property to "nvl" as the closest JSON type: a single value as a
+ * scalar, more than one as an array.  bytes (and raw data of unknown type)
+ * are always an array, and a property with no value is true
+ */
 static void do_prop(di_prop_t prop, nvlist_t *nvl) {
 	int prop_type, nitems;
 	char *name;
 	void *prop_data;
+	char **strs;
+	char *s;
+	int i;
 
-	nitems = prop_type_guess(prop, &prop_data, &prop_type);
-
-	/* XXX: currently we only handle single string properties because those are
-	 *      all that are needed for showing boot parameters.
-	 */
-	if ((nitems != 1) || (prop_type != DI_PROP_TYPE_STRING))
+	if ((nitems = prop_type_guess(prop, &prop_data, &prop_type)) < 0)
 		return;
 
 	name = di_prop_name(prop);
-	fnvlist_add_string(nvl, name, (char *)prop_data);
-}
-
-static int do_node(di_node_t node, void *arg) {
-	nvlist_t *nvl = (nvlist_t *)arg;
-	di_prop_t prop = DI_PROP_NIL;
 
-	if (strcmp(di_node_name(node), "i86pc") == 0) {
-		while ((prop = di_prop_next(node, prop)) != DI_PROP_NIL) {
-			do_prop(prop, nvl);
+	switch (prop_type) {
+	case DI_PROP_TYPE_UNDEF_IT:
+		break;
+	case DI_PROP_TYPE_BOOLEAN:
+		fnvlist_add_boolean_value(nvl, name, B_TRUE);
+		break;
+	case DI_PROP_TYPE_INT:
+		if (nitems == 1)
+			fnvlist_add_int32(nvl, name, *(int32_t *)prop_data);
+		else
+			fnvlist_add_int32_array(nvl, name, prop_data, nitems);
+		break;
+	case DI_PROP_TYPE_INT64:
+		if (nitems == 1)
+			fnvlist_add_int64(nvl, name, *(int64_t *)prop_data);
+		else
+			fnvlist_add_int64_array(nvl, name, prop_data, nitems);
+		break;
+	case DI_PROP_TYPE_BYTE:
+	case DI_PROP_TYPE_UNKNOWN:
+		fnvlist_add_uint8_array(nvl, name, prop_data, nitems);
+		break;
+	case DI_PROP_TYPE_STRING:
+		if (nitems == 1) {
+			fnvlist_add_string(nvl, name, (char *)prop_data);
+			break;
+		}
+		/* the strings are packed one after the other */
+		if ((strs = calloc(nitems, sizeof (char *))) == NULL) {
+			warn("calloc");
+			break;
 		}
-		return (DI_WALK_TERMINATE);
+		for (i = 0, s = prop_data; i < nitems; i++, s += strlen(s) + 1)
+			strs[i] = s;
+		fnvlist_add_string_array(nvl, name, strs, nitems);
+		free(strs);
+		break;
 	}
-	return (DI_WALK_CONTINUE);
 }
 
-void sysinfo_bootparams(nvlist_t *root_nvl) {
+/*
+ * the boot parameters are properties of the root node, so the snapshot
+ * is taken of that node and its properties alone rather than of the whole
+ * tree, which can run to thousands of nodes on a host with many LUNs
+ */
+void sysinfo_bootparams(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
 	nvlist_t *nvl;
 	di_node_t root_node;
+	di_prop_t prop = DI_PROP_NIL;
 
-	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0) {
-		warn("nvlist_alloc");
+	if ((root_node = di_init("/", DINFOPROP)) == DI_NODE_NIL) {
+		warn("di_init");
 		return;
 	}
 
-	root_node = di_init("/", (DINFOSUBTREE | DINFOPROP));
-	if (root_node == DI_NODE_NIL) {
-		warn("di_init() failed\n");
+	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0) {
+		warn("nvlist_alloc");
+		di_fini(root_node);
 		return;
 	}
 
-	di_walk_node(root_node, DI_WALK_CLDFIRST, nvl, do_node);
+	while ((prop = di_prop_next(root_node, prop)) != DI_PROP_NIL)
+		do_prop(prop, nvl);
 	di_fini(root_node);
 
 	fnvlist_add_nvlist(root_nvl, "Boot Parameters", nvl);
@@ -0,0 +1,379 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <libnvpair.h>
+
+#include "sysinfo.h"
+
+/*
+ * the cache file is a small fixed header followed by
+ *
+ *   - the input stamp of every collector at the time it was gathered
+ *   - the packed nvlist of per-collector sections the document was built
+ *     from, so stale sections can be replaced without a full gather
+ *   - the JSON document exactly as it should be printed
+ *
+ * the header lets a reader reject a file that was written by a different
+ * version of this program or that was cut short, without having to parse
+ * anything.
+ *
+ * the cache lives in /var/run, which only root can write to, so nobody
+ * else can plant a document (or a symlink) for root to serve.  a file
+ * that isn't a root-owned 0644 regular file is ignored anyway
+ */
+#define SYSINFO_CACHE		"/var/run/sysinfo.cache"
+#define SYSINFO_CACHE_MAGIC	0x53594e46	/* "SYNF" */
+#define SYSINFO_CACHE_VERSION	2
+
+/*
+ * held (with fcntl, so it goes away with its holder) by the process that is
+ * gathering the full document to rewrite the cache.  it lives next to the
+ * cache so that nobody else can create it first and hold it
+ */
+#define SYSINFO_CACHE_LOCK	"/var/run/sysinfo.lock"
+#define SYSINFO_LOCK_POLL	(10 * (NANOSEC / MILLISEC))
+
+typedef struct sysinfo_cache_hdr {
+	uint32_t sch_magic;
+	uint32_t sch_version;
+	uint32_t sch_nstamps;	/* number of sysinfo_cache_stamp_t */
+	uint32_t sch_pad;
+	uint64_t sch_nvlen;	/* length of the packed sections */
+	uint64_t sch_len;	/* length of the JSON payload */
+	uint64_t sch_cksum;	/* FNV-1a of everything after the header */
+} sysinfo_cache_hdr_t;
+
+uint64_t
+sysinfo_fnv(const void *buf, size_t len, uint64_t h)
+{
+	const uchar_t *p = buf;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+/*
+ * write all of "buf" to "fd", retrying on short writes
+ */
+int
+sysinfo_write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		buf += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/*
+ * create a temp file next to "path" to be renamed over it, named in "tmp"
+ * (empty on failure).  mkstemp never reuses or follows an existing name
+ */
+int
+sysinfo_tmpfile(const char *path, char *tmp, size_t len)
+{
+	int fd;
+
+	(void) snprintf(tmp, len, "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) < 0) {
+		warn("mkstemp(%s)", tmp);
+		tmp[0] = '\0';
+		return (-1);
+	}
+	if (fchmod(fd, 0644) != 0) {
+		warn("fchmod(%s)", tmp);
+		(void) close(fd);
+		(void) unlink(tmp);
+		tmp[0] = '\0';
+		return (-1);
+	}
+	return (fd);
+}
+
+/*
+ * whether "st" is a file root could have written: a regular file owned by
+ * root that nobody else can write
+ */
+boolean_t
+sysinfo_trusted(const struct stat *st)
+{
+	return (S_ISREG(st->st_mode) && st->st_uid == 0 &&
+	    (st->st_mode & (S_IWGRP | S_IWOTH)) == 0);
+}
+
+/*
+ * map the cache file and check that it is complete and was written by this
+ * version.  returns 0 with "c" pointing into the mapping, or -1 if the
+ * cache is missing or unusable and the caller must gather
+ */
+int
+sysinfo_cache_open(sysinfo_cache_t *c)
+{
+	int fd;
+	struct stat st;
+	sysinfo_cache_hdr_t *hdr;
+	char *p;
+	size_t stampslen;
+
+	(void) memset(c, 0, sizeof (*c));
+	c->sc_addr = MAP_FAILED;
+
+	if ((fd = open(SYSINFO_CACHE, O_RDONLY | O_NOFOLLOW)) < 0)
+		return (-1);
+
+	if (fstat(fd, &st) != 0 || !sysinfo_trusted(&st) ||
+	    st.st_size < (off_t)sizeof (*hdr)) {
+		(void) close(fd);
+		return (-1);
+	}
+
+	c->sc_size = st.st_size;
+	c->sc_addr = mmap(NULL, c->sc_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	(void) close(fd);
+	if (c->sc_addr == MAP_FAILED)
+		return (-1);
+
+	hdr = c->sc_addr;
+	if (hdr->sch_magic != SYSINFO_CACHE_MAGIC ||
+	    hdr->sch_version != SYSINFO_CACHE_VERSION)
+		goto fail;
+
+	stampslen = hdr->sch_nstamps * sizeof (sysinfo_cache_stamp_t);
+	if (sizeof (*hdr) + stampslen + hdr->sch_nvlen + hdr->sch_len !=
+	    c->sc_size)
+		goto fail;
+
+	p = (char *)c->sc_addr + sizeof (*hdr);
+	if (hdr->sch_cksum != sysinfo_fnv(p, c->sc_size - sizeof (*hdr),
+	    SYSINFO_FNV_INIT))
+		goto fail;
+
+	c->sc_stamps = (const sysinfo_cache_stamp_t *)p;
+	c->sc_nstamps = hdr->sch_nstamps;
+	c->sc_nv = p + stampslen;
+	c->sc_nvlen = hdr->sch_nvlen;
+	c->sc_json = c->sc_nv + c->sc_nvlen;
+	c->sc_jsonlen = hdr->sch_len;
+	c->sc_cksum = hdr->sch_cksum;
+	return (0);
+
+fail:
+	sysinfo_cache_close(c);
+	return (-1);
+}
+
+void
+sysinfo_cache_close(sysinfo_cache_t *c)
+{
+	if (c->sc_addr != MAP_FAILED)
+		(void) munmap(c->sc_addr, c->sc_size);
+	(void) memset(c, 0, sizeof (*c));
+	c->sc_addr = MAP_FAILED;
+}
+
+int
+sysinfo_cache_stale(const sysinfo_cache_t *c, const uint64_t *stamps,
+    boolean_t *stale)
+{
+	const sysinfo_cache_stamp_t *s;
+	int nstale = 0;
+	uint32_t j;
+	int i;
+
+	for (i = 0; sysinfo_collectors[i].co_name != NULL; i++) {
+		stale[i] = B_TRUE;
+		for (j = 0; j < c->sc_nstamps; j++) {
+			s = &c->sc_stamps[j];
+			if (strncmp(s->scs_name, sysinfo_collectors[i].co_name,
+			    sizeof (s->scs_name)) == 0) {
+				stale[i] = s->scs_stamp != stamps[i];
+				break;
+			}
+		}
+		if (stale[i])
+			nstale++;
+	}
+	return (nstale);
+}
+
+void
+sysinfo_cache_stamps(const sysinfo_cache_t *c, uint64_t *stamps)
+{
+	const sysinfo_cache_stamp_t *s;
+	uint32_t j;
+	int i;
+
+	for (i = 0; sysinfo_collectors[i].co_name != NULL; i++) {
+		stamps[i] = 0;
+		for (j = 0; j < c->sc_nstamps; j++) {
+			s = &c->sc_stamps[j];
+			if (strncmp(s->scs_name, sysinfo_collectors[i].co_name,
+			    sizeof (s->scs_name)) == 0) {
+				stamps[i] = s->scs_stamp;
+				break;
+			}
+		}
+	}
+}
+
+nvlist_t *
+sysinfo_cache_sections(const sysinfo_cache_t *c)
+{
+	nvlist_t *nvl;
+
+	if (nvlist_unpack(c->sc_nv, c->sc_nvlen, &nvl, 0) != 0)
+		return (NULL);
+	return (nvl);
+}
+
+/*
+ * atomically replace the cache file.  the new contents are written to a
+ * temp file in the same directory and renamed over the old one, so readers
+ * only ever see a complete file
+ */
+int
+sysinfo_cache_write(const uint64_t *stamps, nvlist_t *sections,
+    const char *json, size_t len, uint64_t *cksump)
+{
+	int fd = -1;
+	int ret = -1;
+	int i, n;
+	char tmp[PATH_MAX];
+	char *nv = NULL;
+	size_t nvlen = 0;
+	sysinfo_cache_hdr_t hdr;
+	sysinfo_cache_stamp_t *st;
+	uint64_t h;
+
+	n = sysinfo_collector_count();
+	if ((st = calloc(n, sizeof (*st))) == NULL) {
+		warn("calloc");
+		return (-1);
+	}
+	for (i = 0; i < n; i++) {
+		(void) strlcpy(st[i].scs_name, sysinfo_collectors[i].co_name,
+		    sizeof (st[i].scs_name));
+		st[i].scs_stamp = stamps[i];
+	}
+
+	if (nvlist_pack(sections, &nv, &nvlen, NV_ENCODE_NATIVE, 0) != 0) {
+		warnx("nvlist_pack failed");
+		free(st);
+		return (-1);
+	}
+
+	(void) memset(&hdr, 0, sizeof (hdr));
+	hdr.sch_magic = SYSINFO_CACHE_MAGIC;
+	hdr.sch_version = SYSINFO_CACHE_VERSION;
+	hdr.sch_nstamps = n;
+	hdr.sch_nvlen = nvlen;
+	hdr.sch_len = len;
+	h = sysinfo_fnv(st, n * sizeof (*st), SYSINFO_FNV_INIT);
+	h = sysinfo_fnv(nv, nvlen, h);
+	hdr.sch_cksum = sysinfo_fnv(json, len, h);
+
+	if ((fd = sysinfo_tmpfile(SYSINFO_CACHE, tmp, sizeof (tmp))) < 0)
+		goto done;
+
+	if (sysinfo_write_all(fd, (char *)&hdr, sizeof (hdr)) != 0 ||
+	    sysinfo_write_all(fd, (char *)st, n * sizeof (*st)) != 0 ||
+	    sysinfo_write_all(fd, nv, nvlen) != 0 ||
+	    sysinfo_write_all(fd, json, len) != 0) {
+		warn("write(%s)", tmp);
+		goto done;
+	}
+	if (close(fd) != 0) {
+		fd = -1;
+		warn("close(%s)", tmp);
+		goto done;
+	}
+	fd = -1;
+
+	if (rename(tmp, SYSINFO_CACHE) != 0) {
+		warn("rename(%s, %s)", tmp, SYSINFO_CACHE);
+		goto done;
+	}
+	if (cksump != NULL)
+		*cksump = hdr.sch_cksum;
+	ret = 0;
+
+done:
+	if (fd >= 0)
+		(void) close(fd);
+	if (ret != 0)
+		(void) unlink(tmp);
+	free(nv);
+	free(st);
+	return (ret);
+}
+
+/*
+ * take the gather lock, waiting up to "timeout" seconds for whoever holds
+ * it.  polled rather than blocking in F_SETLKW so the wait can be bounded
+ * without a signal handler
+ */
+int
+sysinfo_cache_lock(int timeout)
+{
+	struct flock fl;
+	struct stat st;
+	struct timespec ts;
+	hrtime_t deadline = gethrtime() + (hrtime_t)timeout * NANOSEC;
+	int fd;
+
+	if ((fd = open(SYSINFO_CACHE_LOCK, O_RDWR | O_CREAT | O_NOFOLLOW,
+	    0644)) < 0)
+		return (-1);
+	if (fstat(fd, &st) != 0 || !sysinfo_trusted(&st)) {
+		(void) close(fd);
+		return (-1);
+	}
+
+	(void) memset(&fl, 0, sizeof (fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	while (fcntl(fd, F_SETLK, &fl) != 0) {
+		if ((errno != EAGAIN && errno != EACCES && errno != EINTR) ||
+		    gethrtime() >= deadline) {
+			if (timeout > 0 && (errno == EAGAIN || errno == EACCES))
+				warnx("timed out after %d seconds waiting for "
+				    "%s", timeout, SYSINFO_CACHE_LOCK);
+			(void) close(fd);
+			return (-1);
+		}
+		ts.tv_sec = 0;
+		ts.tv_nsec = SYSINFO_LOCK_POLL;
+		(void) nanosleep(&ts, NULL);
+	}
+	return (fd);
+}
+
+void
+sysinfo_cache_unlock(int fd)
+{
+	// closing the file drops the lock
+	if (fd >= 0)
+		(void) close(fd);
+}
@@ -0,0 +1,97 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <libnvpair.h>
+
+#include "sysinfo.h"
+
+int
+sysinfo_client_fetch(const char *keys, sysinfo_buf_t *out)
+{
+	int fd;
+	int ret = -1;
+	ssize_t n;
+	struct sockaddr_un sun;
+	struct timeval tv;
+	struct pollfd pfd;
+	socklen_t len;
+	int flags, error;
+	char req[SYSINFOD_MAXREQ];
+	char buf[8192];
+	size_t start = out->sb_len;
+
+	if (keys == NULL)
+		keys = "";
+	if (snprintf(req, sizeof (req), "%s\n", keys) >= sizeof (req))
+		return (-1);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return (-1);
+
+	(void) memset(&sun, 0, sizeof (sun));
+	sun.sun_family = AF_UNIX;
+	(void) strlcpy(sun.sun_path, SYSINFOD_SOCKET, sizeof (sun.sun_path));
+
+	/*
+	 * a missing socket or a dead daemon just means "gather yourself", and
+	 * so does one that doesn't answer within SYSINFOD_TIMEOUT: connect
+	 * without blocking, then bound every read and write
+	 */
+	if ((flags = fcntl(fd, F_GETFL)) < 0 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+		goto done;
+	if (connect(fd, (struct sockaddr *)&sun, sizeof (sun)) != 0) {
+		if (errno != EINPROGRESS)
+			goto done;
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		len = sizeof (error);
+		if (poll(&pfd, 1, SYSINFOD_TIMEOUT * MILLISEC) != 1 ||
+		    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 ||
+		    error != 0)
+			goto done;
+	}
+	if (fcntl(fd, F_SETFL, flags) != 0)
+		goto done;
+
+	tv.tv_sec = SYSINFOD_TIMEOUT;
+	tv.tv_usec = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) != 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv)) != 0)
+		goto done;
+
+	if (sysinfo_write_all(fd, req, strlen(req)) != 0)
+		goto done;
+
+	for (;;) {
+		// a timeout fails the read with EAGAIN
+		if ((n = read(fd, buf, sizeof (buf))) < 0) {
+			if (errno == EINTR)
+				continue;
+			goto done;
+		}
+		if (n == 0)
+			break;
+		sysinfo_buf_append(out, buf, n);
+	}
+
+	// the daemon always ends a complete reply with a newline
+	if (!out->sb_error && out->sb_len > start &&
+	    out->sb_data[out->sb_len - 1] == '\n')
+		ret = 0;
+
+done:
+	if (ret != 0 && !out->sb_error && out->sb_len > start) {
+		out->sb_len = start;
+		out->sb_data[start] = '\0';
+	}
+	(void) close(fd);
+	return (ret);
+}
@@ -0,0 +1,200 @@
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <kstat.h>
+#include <libdevinfo.h>
+
+#include <libdladm.h>
+#include <libnvpair.h>
+#include <libzfs.h>
+
+#include "sysinfo.h"
+
+/*
+ * platform handles shared by all collectors for the lifetime of a context.
+ * each handle is opened the first time a collector asks for it and closed
+ * when the context is destroyed, so a run opens each at most once no
+ * matter how many collectors (or links, or disks) use it
+ */
+struct sysinfo_ctx {
+	pthread_mutex_t sc_lock;	/* protects the lazy opens below */
+	pthread_mutex_t sc_kstat_lock;	/* libkstat handles aren't MT-safe */
+	kstat_ctl_t *sc_kstat;
+	dladm_handle_t sc_dladm;
+	libzfs_handle_t *sc_zfs;
+	di_node_t sc_devinfo;
+
+	/*
+	 * the boot snapshot, see sysinfo_ctx_boot.  only the thread running
+	 * a gather touches these, so they aren't locked
+	 */
+	boolean_t sc_boot_save;		/* write the snapshot back */
+	boolean_t sc_boot_read;		/* looked for the snapshot */
+	boolean_t sc_boot_dirty;	/* sections added since it was read */
+	uint64_t sc_boot_time;
+	nvlist_t *sc_boot;
+};
+
+sysinfo_ctx_t *
+sysinfo_ctx_create(boolean_t save_boot)
+{
+	sysinfo_ctx_t *ctx;
+
+	if ((ctx = calloc(1, sizeof (*ctx))) == NULL) {
+		warn("calloc");
+		return (NULL);
+	}
+	(void) pthread_mutex_init(&ctx->sc_lock, NULL);
+	(void) pthread_mutex_init(&ctx->sc_kstat_lock, NULL);
+	ctx->sc_devinfo = DI_NODE_NIL;
+	ctx->sc_boot_save = save_boot;
+	return (ctx);
+}
+
+void
+sysinfo_ctx_destroy(sysinfo_ctx_t *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	if (ctx->sc_kstat != NULL)
+		(void) kstat_close(ctx->sc_kstat);
+	if (ctx->sc_dladm != NULL)
+		dladm_close(ctx->sc_dladm);
+	if (ctx->sc_zfs != NULL)
+		libzfs_fini(ctx->sc_zfs);
+	if (ctx->sc_devinfo != DI_NODE_NIL)
+		di_fini(ctx->sc_devinfo);
+	nvlist_free(ctx->sc_boot);
+
+	(void) pthread_mutex_destroy(&ctx->sc_lock);
+	(void) pthread_mutex_destroy(&ctx->sc_kstat_lock);
+	free(ctx);
+}
+
+/*
+ * bring long-lived handles up to date before another gather with the same
+ * context: pick up kstats created since the chain was read, and drop the
+ * devinfo snapshot so the next user takes a new one
+ */
+void
+sysinfo_ctx_refresh(sysinfo_ctx_t *ctx)
+{
+	(void) pthread_mutex_lock(&ctx->sc_kstat_lock);
+	if (ctx->sc_kstat != NULL)
+		(void) kstat_chain_update(ctx->sc_kstat);
+	(void) pthread_mutex_unlock(&ctx->sc_kstat_lock);
+
+	(void) pthread_mutex_lock(&ctx->sc_lock);
+	if (ctx->sc_devinfo != DI_NODE_NIL) {
+		di_fini(ctx->sc_devinfo);
+		ctx->sc_devinfo = DI_NODE_NIL;
+	}
+	(void) pthread_mutex_unlock(&ctx->sc_lock);
+}
+
+kstat_ctl_t *
+sysinfo_ctx_kstat_hold(sysinfo_ctx_t *ctx)
+{
+	(void) pthread_mutex_lock(&ctx->sc_kstat_lock);
+	if (ctx->sc_kstat == NULL && (ctx->sc_kstat = kstat_open()) == NULL) {
+		warn("kstat_open");
+		(void) pthread_mutex_unlock(&ctx->sc_kstat_lock);
+		return (NULL);
+	}
+	return (ctx->sc_kstat);
+}
+
+void
+sysinfo_ctx_kstat_rele(sysinfo_ctx_t *ctx)
+{
+	(void) pthread_mutex_unlock(&ctx->sc_kstat_lock);
+}
+
+dladm_handle_t
+sysinfo_ctx_dladm(sysinfo_ctx_t *ctx)
+{
+	dladm_handle_t handle;
+
+	(void) pthread_mutex_lock(&ctx->sc_lock);
+	if (ctx->sc_dladm == NULL &&
+	    dladm_open(&ctx->sc_dladm) != DLADM_STATUS_OK) {
+		warnx("dladm_open failed");
+		ctx->sc_dladm = NULL;
+	}
+	handle = ctx->sc_dladm;
+	(void) pthread_mutex_unlock(&ctx->sc_lock);
+	return (handle);
+}
+
+libzfs_handle_t *
+sysinfo_ctx_zfs(sysinfo_ctx_t *ctx)
+{
+	libzfs_handle_t *zh;
+
+	(void) pthread_mutex_lock(&ctx->sc_lock);
+	if (ctx->sc_zfs == NULL && (ctx->sc_zfs = libzfs_init()) == NULL)
+		warn("libzfs_init");
+	zh = ctx->sc_zfs;
+	(void) pthread_mutex_unlock(&ctx->sc_lock);
+	return (zh);
+}
+
+di_node_t
+sysinfo_ctx_devinfo(sysinfo_ctx_t *ctx)
+{
+	di_node_t root;
+
+	(void) pthread_mutex_lock(&ctx->sc_lock);
+	if (ctx->sc_devinfo == DI_NODE_NIL &&
+	    (ctx->sc_devinfo = di_init("/", DINFOCPYALL)) == DI_NODE_NIL)
+		warn("di_init");
+	root = ctx->sc_devinfo;
+	(void) pthread_mutex_unlock(&ctx->sc_lock);
+	return (root);
+}
+
+/*
+ * the sections of the boot-scoped collectors saved earlier in this boot,
+ * read the first time they are asked for.  a context that lives across
+ * refreshes keeps them, since nothing in them can change before a reboot
+ */
+nvlist_t *
+sysinfo_ctx_boot(sysinfo_ctx_t *ctx)
+{
+	if (!ctx->sc_boot_read) {
+		ctx->sc_boot_read = B_TRUE;
+		if ((ctx->sc_boot_time = sysinfo_boot_time(ctx)) != 0)
+			ctx->sc_boot = sysinfo_boot_read(ctx->sc_boot_time);
+	}
+	return (ctx->sc_boot);
+}
+
+void
+sysinfo_ctx_boot_discard(sysinfo_ctx_t *ctx)
+{
+	(void) sysinfo_ctx_boot(ctx);
+	nvlist_free(ctx->sc_boot);
+	ctx->sc_boot = NULL;
+}
+
+void
+sysinfo_ctx_boot_add(sysinfo_ctx_t *ctx, const char *name,
+    nvlist_t *section)
+{
+	if (ctx->sc_boot == NULL)
+		ctx->sc_boot = fnvlist_alloc();
+	fnvlist_add_nvlist(ctx->sc_boot, name, section);
+	ctx->sc_boot_dirty = B_TRUE;
+}
+
+void
+sysinfo_ctx_boot_sync(sysinfo_ctx_t *ctx)
+{
+	if (!ctx->sc_boot_save || !ctx->sc_boot_dirty ||
+	    ctx->sc_boot_time == 0)
+		return;
+	if (sysinfo_boot_write(ctx->sc_boot_time, ctx->sc_boot) == 0)
+		ctx->sc_boot_dirty = B_FALSE;
+}
@@ -1,76 +1,432 @@
 #include <err.h>
+#include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <sys/utsname.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/dkio.h>
 #include <sys/vtoc.h>
 #include <fcntl.h>
+#include <libdevinfo.h>
 
 #include <libnvpair.h>
 
-void do_disk(const char *disk, nvlist_t *nvl) {
+#include "sysinfo.h"
+
+/*
+ * the inventory comes from the devinfo snapshot: the disk drivers publish
+ * each disk's geometry, whether it is removable and its inquiry data as
+ * properties on the device node, so nothing has to touch the media.
+ *
+ * only disks whose driver doesn't publish a size are opened.  those are
+ * probed by a small pool of threads so that a chassis full of drives
+ * doesn't take one open and two ioctls after another, and so that a drive
+ * that never answers only costs DISK_TIMEOUT seconds.  a probe that runs
+ * past its deadline is abandoned: the disk is reported with an error, its
+ * thread is left to finish (or not) on its own and another thread is
+ * started to take its place.
+ *
+ * a disk stays on the "hung" list until its abandoned probe returns, and
+ * isn't probed again while it is there, so a long-running sysinfod or
+ * libsysinfo consumer has at most one thread stuck on each bad device no
+ * matter how often it gathers
+ */
+#define DISK_THREADS	8
+#define DISK_TIMEOUT	5	/* seconds per disk */
+
+#define DISK_INQLEN	64
+
+#define DEVICES_PREFIX	"../../devices"
+
+typedef enum {
+	DISK_PENDING,
+	DISK_RUNNING,
+	DISK_DONE,
+	DISK_FAILED,
+	DISK_TIMEDOUT
+} disk_state_t;
+
+struct disk {
+	char dk_name[MAXNAMELEN];
+	char *dk_path;		/* devfs path of the s2 minor */
+	disk_state_t dk_state;
+	hrtime_t dk_start;
+	int dk_removable;
+	uint64_t dk_bytes;
+	char dk_vendor[DISK_INQLEN];
+	char dk_product[DISK_INQLEN];
+	char dk_serial[DISK_INQLEN];
+	int dk_ssd;		/* -1 if the driver doesn't say */
+};
+
+/*
+ * shared between sysinfo_disks and the probe threads, and freed by
+ * whichever lets go of it last since abandoned threads may outlive the
+ * collector
+ */
+struct probe {
+	pthread_mutex_t p_lock;
+	pthread_cond_t p_cv;
+	int p_refs;
+	int p_next;
+	int p_count;
+	struct disk *p_disks;
+	struct disk **p_bypath;	/* disks with a dk_path, sorted by it */
+	int p_npaths;
+};
+
+struct hung {
+	char h_name[MAXNAMELEN];
+	struct hung *h_next;
+};
+
+static pthread_mutex_t hung_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hung *hung;
+
+static boolean_t
+hung_find(const char *name)
+{
+	struct hung *h;
+
+	(void) pthread_mutex_lock(&hung_lock);
+	for (h = hung; h != NULL; h = h->h_next) {
+		if (strcmp(h->h_name, name) == 0)
+			break;
+	}
+	(void) pthread_mutex_unlock(&hung_lock);
+	return (h != NULL);
+}
+
+static void
+hung_add(const char *name)
+{
+	struct hung *h;
+
+	if ((h = malloc(sizeof (*h))) == NULL)
+		return;
+	(void) strlcpy(h->h_name, name, sizeof (h->h_name));
+	(void) pthread_mutex_lock(&hung_lock);
+	h->h_next = hung;
+	hung = h;
+	(void) pthread_mutex_unlock(&hung_lock);
+}
+
+static void
+hung_remove(const char *name)
+{
+	struct hung **hp, *h;
+
+	(void) pthread_mutex_lock(&hung_lock);
+	for (hp = &hung; (h = *hp) != NULL; hp = &h->h_next) {
+		if (strcmp(h->h_name, name) == 0) {
+			*hp = h->h_next;
+			free(h);
+			break;
+		}
+	}
+	(void) pthread_mutex_unlock(&hung_lock);
+}
+
+static int
+do_disk(const char *disk, int *removable, uint64_t *bytes)
+{
 	int devnode;
-	int ret;
-	int removable;
+	int ret = -1;
 	struct dk_minfo mediainfo;
-	unsigned long long bytes;
-	nvlist_t *sub_nvl;
 
 	char devpath[PATH_MAX];
 	snprintf(devpath, PATH_MAX, "/dev/rdsk/%sp0", disk);
 	if ((devnode = open(devpath, O_RDONLY)) < 0 ) {
 		warn("open(%s)", devpath);
-		return;
+		return (-1);
 	}
 
-	ret = ioctl(devnode, DKIOCREMOVABLE, &removable);
-	if (ret < 0) {
+	if (ioctl(devnode, DKIOCREMOVABLE, removable) < 0) {
 		warn("failed ioctl1");
 		goto done;
 	}
-	if (removable) {
+	if (*removable) {
 		// we don't care about these
+		ret = 0;
 		goto done;
 	}
 
-	ret = ioctl(devnode, DKIOCGMEDIAINFO, &mediainfo);
-	if (ret < 0) {
+	if (ioctl(devnode, DKIOCGMEDIAINFO, &mediainfo) < 0) {
 		warn("failed ioctl2");
 		goto done;
 	}
 
-	bytes = mediainfo.dki_capacity * mediainfo.dki_lbsize;
+	*bytes = (uint64_t)mediainfo.dki_capacity * mediainfo.dki_lbsize;
+	ret = 0;
 
-	if (nvlist_alloc(&sub_nvl, NV_UNIQUE_NAME, 0) != 0) {
-		warn("nvlist_alloc");
-		return;
+done:
+	close(devnode);
+	return (ret);
+}
+
+static void
+probe_rele(struct probe *p)
+{
+	boolean_t last;
+	int i;
+
+	(void) pthread_mutex_lock(&p->p_lock);
+	last = --p->p_refs == 0;
+	(void) pthread_mutex_unlock(&p->p_lock);
+
+	if (last) {
+		(void) pthread_mutex_destroy(&p->p_lock);
+		(void) pthread_cond_destroy(&p->p_cv);
+		for (i = 0; i < p->p_count; i++)
+			free(p->p_disks[i].dk_path);
+		free(p->p_disks);
+		free(p->p_bypath);
+		free(p);
 	}
+}
 
-	fnvlist_add_int32(sub_nvl, "Size in GB", bytes / 1000 / 1000 / 1000);
-	fnvlist_add_nvlist(nvl, disk, sub_nvl);
-	nvlist_free(sub_nvl);
+static void *
+prober(void *arg)
+{
+	struct probe *p = arg;
+	struct disk *dk;
+	char name[MAXNAMELEN];
+	int removable;
+	uint64_t bytes;
+	int ret;
 
-done:
-	close(devnode);
+	(void) pthread_mutex_lock(&p->p_lock);
+	while (p->p_next < p->p_count) {
+		dk = &p->p_disks[p->p_next++];
+		// already known from the snapshot
+		if (dk->dk_state != DISK_PENDING)
+			continue;
+		dk->dk_state = DISK_RUNNING;
+		dk->dk_start = gethrtime();
+		(void) strlcpy(name, dk->dk_name, sizeof (name));
+		(void) pthread_mutex_unlock(&p->p_lock);
+
+		removable = 0;
+		bytes = 0;
+		ret = do_disk(name, &removable, &bytes);
+
+		(void) pthread_mutex_lock(&p->p_lock);
+		// the result is thrown away if we were given up on
+		if (dk->dk_state == DISK_RUNNING) {
+			dk->dk_state = ret == 0 ? DISK_DONE : DISK_FAILED;
+			dk->dk_removable = removable;
+			dk->dk_bytes = bytes;
+			(void) pthread_cond_broadcast(&p->p_cv);
+		} else {
+			// the disk can be probed again
+			hung_remove(name);
+		}
+	}
+	(void) pthread_mutex_unlock(&p->p_lock);
+
+	probe_rele(p);
+	return (NULL);
+}
+
+static boolean_t
+probe_start(struct probe *p, pthread_attr_t *attr)
+{
+	pthread_t tid;
+
+	(void) pthread_mutex_lock(&p->p_lock);
+	p->p_refs++;
+	(void) pthread_mutex_unlock(&p->p_lock);
+
+	if ((errno = pthread_create(&tid, attr, prober, p)) != 0) {
+		warn("pthread_create");
+		probe_rele(p);
+		return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * wait until every disk has an answer or has run out of time, with
+ * p_lock held
+ */
+static void
+probe_wait(struct probe *p, pthread_attr_t *attr)
+{
+	struct disk *dk;
+	struct timespec ts;
+	hrtime_t now, deadline;
+	boolean_t busy;
+	int i;
+
+	for (;;) {
+		now = gethrtime();
+		deadline = 0;
+		busy = B_FALSE;
+		for (i = 0; i < p->p_count; i++) {
+			dk = &p->p_disks[i];
+			if (dk->dk_state == DISK_PENDING) {
+				busy = B_TRUE;
+			} else if (dk->dk_state == DISK_RUNNING) {
+				if (now - dk->dk_start >=
+				    DISK_TIMEOUT * NANOSEC) {
+					warnx("%s: timed out after %d seconds",
+					    dk->dk_name, DISK_TIMEOUT);
+					dk->dk_state = DISK_TIMEDOUT;
+					hung_add(dk->dk_name);
+					if (p->p_next == p->p_count)
+						continue;
+					// replace the thread that is stuck
+					(void) pthread_mutex_unlock(&p->p_lock);
+					(void) probe_start(p, attr);
+					(void) pthread_mutex_lock(&p->p_lock);
+					break;
+				}
+				busy = B_TRUE;
+				if (deadline == 0 || dk->dk_start +
+				    DISK_TIMEOUT * NANOSEC < deadline)
+					deadline = dk->dk_start +
+					    DISK_TIMEOUT * NANOSEC;
+			}
+		}
+		if (i < p->p_count)
+			continue;
+		if (!busy)
+			return;
+
+		if (deadline == 0) {
+			(void) pthread_cond_wait(&p->p_cv, &p->p_lock);
+			continue;
+		}
+		(void) clock_gettime(CLOCK_REALTIME, &ts);
+		now = (hrtime_t)ts.tv_sec * NANOSEC + ts.tv_nsec +
+		    (deadline - gethrtime());
+		ts.tv_sec = now / NANOSEC;
+		ts.tv_nsec = now % NANOSEC;
+		(void) pthread_cond_timedwait(&p->p_cv, &p->p_lock, &ts);
+	}
+}
+
+static int
+disk_compare(const void *a, const void *b)
+{
+	return (strcmp(((const struct disk *)a)->dk_name,
+	    ((const struct disk *)b)->dk_name));
+}
+
+static int
+path_compare(const void *a, const void *b)
+{
+	return (strcmp((*(struct disk * const *)a)->dk_path,
+	    (*(struct disk * const *)b)->dk_path));
+}
+
+/*
+ * copy out an inquiry string without the blanks it's padded with to its
+ * field width
+ */
+static void
+inquiry_string(di_node_t node, const char *name, char *buf)
+{
+	char *str;
+	size_t len;
+
+	if (di_prop_lookup_strings(DDI_DEV_T_ANY, node, name, &str) < 1)
+		return;
+	for (len = strlen(str); len > 0 && str[len - 1] == ' '; len--)
+		;
+	if (len >= DISK_INQLEN)
+		len = DISK_INQLEN - 1;
+	(void) memcpy(buf, str, len);
+	buf[len] = '\0';
+}
+
+/*
+ * called for every block minor in the snapshot.  if it's the s2 minor of
+ * one of our disks, fill in everything the driver publishes about it and
+ * mark it done so it won't be opened
+ */
+static int
+do_minor(di_node_t node, di_minor_t minor, void *arg)
+{
+	struct probe *p = arg;
+	struct disk key;
+	struct disk *kp = &key;
+	struct disk **found;
+	struct disk *dk;
+	char *path;
+	int64_t *nblocks;
+	int *blksize;
+	int *ip;
+
+	if ((path = di_devfs_minor_path(minor)) == NULL)
+		return (DI_WALK_CONTINUE);
+	key.dk_path = path;
+	found = bsearch(&kp, p->p_bypath, p->p_npaths,
+	    sizeof (struct disk *), path_compare);
+	di_devfs_path_free(path);
+	if (found == NULL)
+		return (DI_WALK_CONTINUE);
+	dk = *found;
+
+	inquiry_string(node, "inquiry-vendor-id", dk->dk_vendor);
+	inquiry_string(node, "inquiry-product-id", dk->dk_product);
+	inquiry_string(node, "inquiry-serial-no", dk->dk_serial);
+	if (di_prop_lookup_ints(DDI_DEV_T_ANY, node, "device-solid-state",
+	    &ip) == 1)
+		dk->dk_ssd = *ip != 0;
+
+	// a boolean property: there is no value, it's just present or not
+	if (di_prop_lookup_ints(DDI_DEV_T_ANY, node, "removable-media",
+	    &ip) >= 0) {
+		dk->dk_removable = 1;
+		dk->dk_state = DISK_DONE;
+		return (DI_WALK_CONTINUE);
+	}
+
+	if (di_prop_lookup_int64(DDI_DEV_T_ANY, node, "device-nblocks",
+	    &nblocks) == 1 &&
+	    di_prop_lookup_ints(DDI_DEV_T_ANY, node, "device-blksize",
+	    &blksize) == 1) {
+		dk->dk_bytes = (uint64_t)*nblocks * *blksize;
+		dk->dk_state = DISK_DONE;
+	}
+	return (DI_WALK_CONTINUE);
 }
 
-void sysinfo_disks(nvlist_t *root_nvl) {
+void sysinfo_disks(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
 	DIR *d;
 	struct dirent *dp;
 	nvlist_t *nvl;
+	nvlist_t *sub_nvl;
+	struct probe *p;
+	struct disk *dk;
+	pthread_attr_t attr;
+	di_node_t root;
+	char path[PATH_MAX];
+	char link[PATH_MAX];
+	ssize_t n;
+	int size = 0;
+	int npending = 0;
+	int nthreads = 0;
+	int i;
 
-	d = opendir("/dev/dsk");
-	if (d == NULL) {
-		warn("opendir(/dev/dsk)");
+	if ((p = calloc(1, sizeof (*p))) == NULL) {
+		warn("calloc");
 		return;
 	}
+	(void) pthread_mutex_init(&p->p_lock, NULL);
+	(void) pthread_cond_init(&p->p_cv, NULL);
+	p->p_refs = 1;
 
-	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0) {
-		warn("nvlist_alloc");
-		closedir(d);
+	d = opendir("/dev/dsk");
+	if (d == NULL) {
+		warn("opendir(/dev/dsk)");
+		probe_rele(p);
 		return;
 	}
 
@@ -79,19 +435,135 @@ void sysinfo_disks(nvlist_t *root_nvl) {
 		// only interested in files that end in "s2"
 		char *name = dp->d_name;
 		int len = strlen(name);
-		if (len < 2)
+		if (len < 2 || len >= MAXNAMELEN)
 			continue;
-		if (strncmp(name + (len - 2), "s2", 2) == 0) {
-			// matches - chop off "s2"
-			char name[PATH_MAX];
-			strncpy(name, dp->d_name, len - 2);
-			name[len - 2] = '\0';
-			do_disk(name, nvl);
+		if (strncmp(name + (len - 2), "s2", 2) != 0)
+			continue;
+
+		if (p->p_count == size) {
+			size = size == 0 ? 64 : size * 2;
+			if ((dk = realloc(p->p_disks,
+			    size * sizeof (struct disk))) == NULL) {
+				warn("realloc");
+				break;
+			}
+			p->p_disks = dk;
+		}
+
+		// matches - chop off "s2"
+		dk = &p->p_disks[p->p_count++];
+		(void) memset(dk, 0, sizeof (*dk));
+		(void) strncpy(dk->dk_name, name, len - 2);
+		dk->dk_ssd = -1;
+
+		// /dev/dsk/<disk>s2 -> ../../devices/<devfs path>
+		(void) snprintf(path, sizeof (path), "/dev/dsk/%s", name);
+		if ((n = readlink(path, link, sizeof (link) - 1)) > 0) {
+			link[n] = '\0';
+			if (strncmp(link, DEVICES_PREFIX,
+			    strlen(DEVICES_PREFIX)) == 0)
+				dk->dk_path = strdup(link +
+				    strlen(DEVICES_PREFIX));
 		}
 	}
 
 	closedir(d);
 
+	// the section is built in name order, whatever order probes finish in
+	qsort(p->p_disks, p->p_count, sizeof (struct disk), disk_compare);
+
+	/*
+	 * look every disk up in the snapshot by the path its /dev link points
+	 * to.  disks without a path are left for the probe
+	 */
+	if (p->p_count > 0 && (root = sysinfo_ctx_devinfo(ctx)) != DI_NODE_NIL) {
+		if ((p->p_bypath = calloc(p->p_count,
+		    sizeof (struct disk *))) == NULL) {
+			warn("calloc");
+		} else {
+			for (i = 0; i < p->p_count; i++) {
+				if (p->p_disks[i].dk_path != NULL)
+					p->p_bypath[p->p_npaths++] =
+					    &p->p_disks[i];
+			}
+			qsort(p->p_bypath, p->p_npaths, sizeof (struct disk *),
+			    path_compare);
+			(void) di_walk_minor(root, DDI_NT_BLOCK, 0, p,
+			    do_minor);
+		}
+	}
+
+	for (i = 0; i < p->p_count; i++) {
+		dk = &p->p_disks[i];
+		if (dk->dk_state != DISK_PENDING)
+			continue;
+		// an earlier probe is still stuck on it; don't add another
+		if (hung_find(dk->dk_name)) {
+			dk->dk_state = DISK_TIMEDOUT;
+			continue;
+		}
+		npending++;
+	}
+
+	(void) pthread_attr_init(&attr);
+	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < DISK_THREADS && i < npending; i++) {
+		if (probe_start(p, &attr))
+			nthreads++;
+	}
+
+	if (npending > 0 && nthreads == 0) {
+		// no threads at all; probe here with no deadline
+		p->p_refs++;
+		(void) prober(p);
+	}
+
+	(void) pthread_mutex_lock(&p->p_lock);
+	probe_wait(p, &attr);
+	(void) pthread_attr_destroy(&attr);
+
+	if (nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0) != 0) {
+		warn("nvlist_alloc");
+		(void) pthread_mutex_unlock(&p->p_lock);
+		probe_rele(p);
+		return;
+	}
+
+	for (i = 0; i < p->p_count; i++) {
+		dk = &p->p_disks[i];
+		switch (dk->dk_state) {
+		case DISK_DONE:
+			if (dk->dk_removable)
+				continue;
+			sub_nvl = fnvlist_alloc();
+			fnvlist_add_int32(sub_nvl, "Size in GB",
+			    dk->dk_bytes / 1000 / 1000 / 1000);
+			if (dk->dk_vendor[0] != '\0')
+				fnvlist_add_string(sub_nvl, "Vendor",
+				    dk->dk_vendor);
+			if (dk->dk_product[0] != '\0')
+				fnvlist_add_string(sub_nvl, "Model",
+				    dk->dk_product);
+			if (dk->dk_serial[0] != '\0')
+				fnvlist_add_string(sub_nvl, "Serial Number",
+				    dk->dk_serial);
+			if (dk->dk_ssd != -1)
+				fnvlist_add_boolean_value(sub_nvl, "SSD",
+				    dk->dk_ssd ? B_TRUE : B_FALSE);
+			break;
+		case DISK_TIMEDOUT:
+			sub_nvl = fnvlist_alloc();
+			fnvlist_add_string(sub_nvl, "Error", "timed out");
+			break;
+		default:
+			continue;
+		}
+		fnvlist_add_nvlist(nvl, dk->dk_name, sub_nvl);
+		nvlist_free(sub_nvl);
+	}
+	(void) pthread_mutex_unlock(&p->p_lock);
+	probe_rele(p);
+
 	fnvlist_add_nvlist(root_nvl, "Disks", nvl);
 	nvlist_free(nvl);
 }
@@ -0,0 +1,412 @@
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <libnvpair.h>
+
+#include "sysinfo.h"
+
+static const char *bootparams_keys[] = { "Boot Parameters", NULL };
+static const char *uname_keys[] = { "System Type", "Hostname", NULL };
+static const char *image_keys[] = { "Live Image", NULL };
+static const char *smartdc_keys[] = { "SDC Version", "Setup", NULL };
+static const char *smbios_keys[] = {
+	"Manufacturer", "Product", "HW Version", "Serial Number", "Asset Tag",
+	"Location Tag", "Part Number", "UUID", "SKU Number", "HW Family",
+	"CPU Type", "CPU Total Cores", NULL
+};
+static const char *uptime_keys[] = { "Boot Time", NULL };
+static const char *sysconf_keys[] = { "MiB of Memory", NULL };
+static const char *zfs_keys[] = {
+	"Zpool", "Zpool Creation", "Zpool Size in GiB", "Zpool Disks",
+	"Zpool Profile", "Zpools", "Zpool Health", NULL
+};
+static const char *disks_keys[] = { "Disks", NULL };
+static const char *kstat_keys[] = { "CPU Physical Cores", NULL };
+static const char *network_keys[] = { "Network Interfaces", NULL };
+
+/*
+ * the collectors marked as boot-scoped report things that can't change
+ * without a reboot (firmware tables, boot arguments, the platform image,
+ * physical memory), so they run once per boot and are served from the
+ * boot snapshot after that.
+ *
+ * files whose metadata changes when a collector's output would.  a
+ * collector with no inputs and no stamp function is only refreshed by a
+ * full gather (-f, -u)
+ */
+static const char *smartdc_inputs[] = {
+	"/.smartdc_version", "/var/lib/setup.json", NULL
+};
+static const char *disks_inputs[] = { "/dev/dsk", NULL };
+static const char *network_inputs[] = { "/usbkey/config", NULL };
+
+/*
+ * the document is assembled in this order, which is the order the keys
+ * have always been printed in.  "image" was split out of "uname" and sits
+ * right after it so "Live Image" still follows "Hostname"
+ */
+sysinfo_collector_t sysinfo_collectors[] = {
+	{ "bootparams",	sysinfo_bootparams,	bootparams_keys,
+	    NULL,		NULL,			B_TRUE },
+	{ "uname",	sysinfo_uname,		uname_keys,
+	    NULL,		sysinfo_uname_stamp,	B_FALSE },
+	{ "image",	sysinfo_image,		image_keys,
+	    NULL,		NULL,			B_TRUE },
+	{ "smartdc",	sysinfo_smartdc,	smartdc_keys,
+	    smartdc_inputs,	NULL,			B_FALSE },
+	{ "smbios",	sysinfo_smbios,		smbios_keys,
+	    NULL,		NULL,			B_TRUE },
+	{ "uptime",	sysinfo_uptime,		uptime_keys,
+	    NULL,		NULL,			B_FALSE },
+	{ "sysconf",	sysinfo_sysconf,	sysconf_keys,
+	    NULL,		NULL,			B_TRUE },
+	{ "zfs",	sysinfo_zfs,		zfs_keys,
+	    NULL,		NULL,			B_FALSE },
+	{ "disks",	sysinfo_disks,		disks_keys,
+	    disks_inputs,	NULL,			B_FALSE },
+	{ "kstat",	sysinfo_kstat,		kstat_keys,
+	    NULL,		NULL,			B_FALSE },
+	{ "network",	sysinfo_network,	network_keys,
+	    network_inputs,	NULL,			B_FALSE },
+	{ NULL,		NULL,			NULL,
+	    NULL,		NULL,			B_FALSE }
+};
+
+int
+sysinfo_collector_count(void)
+{
+	int n;
+
+	for (n = 0; sysinfo_collectors[n].co_name != NULL; n++)
+		;
+	return (n);
+}
+
+int
+sysinfo_collector_lookup(const char *name)
+{
+	int i;
+
+	for (i = 0; sysinfo_collectors[i].co_name != NULL; i++) {
+		if (strcmp(sysinfo_collectors[i].co_name, name) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+int
+sysinfo_key_lookup(const char *key)
+{
+	const char **k;
+	int i;
+
+	for (i = 0; sysinfo_collectors[i].co_name != NULL; i++) {
+		for (k = sysinfo_collectors[i].co_keys; *k != NULL; k++) {
+			if (strcmp(*k, key) == 0)
+				return (i);
+		}
+	}
+	return (-1);
+}
+
+uint64_t
+sysinfo_collector_stamp(int i)
+{
+	sysinfo_collector_t *co = &sysinfo_collectors[i];
+	uint64_t h = SYSINFO_FNV_INIT;
+	const char **path;
+	struct stat st;
+	uint64_t v;
+
+	if (co->co_inputs == NULL && co->co_stamp == NULL)
+		return (0);
+
+	for (path = co->co_inputs; path != NULL && *path != NULL; path++) {
+		if (stat(*path, &st) != 0) {
+			// a missing file is an input state too
+			v = errno;
+			h = sysinfo_fnv(&v, sizeof (v), h);
+			continue;
+		}
+		h = sysinfo_fnv(&st.st_mtim, sizeof (st.st_mtim), h);
+		h = sysinfo_fnv(&st.st_ino, sizeof (st.st_ino), h);
+		h = sysinfo_fnv(&st.st_size, sizeof (st.st_size), h);
+	}
+
+	if (co->co_stamp != NULL) {
+		v = co->co_stamp();
+		h = sysinfo_fnv(&v, sizeof (v), h);
+	}
+
+	return (h);
+}
+
+void
+sysinfo_stamps(uint64_t *stamps)
+{
+	int i;
+
+	for (i = 0; sysinfo_collectors[i].co_name != NULL; i++)
+		stamps[i] = sysinfo_collector_stamp(i);
+}
+
+/*
+ * shared state for the worker threads.  each collector writes into its own
+ * nvlist in "sections", so the only thing the workers contend on is the
+ * index of the next collector to run
+ */
+struct gather {
+	sysinfo_ctx_t *g_ctx;
+	pthread_mutex_t g_lock;
+	int g_next;
+	int g_count;
+	const boolean_t *g_want;
+	nvlist_t **g_sections;
+	hrtime_t *g_times;
+	boolean_t *g_boot;	/* section came from the boot snapshot */
+};
+
+static void
+run_collector(struct gather *g, int i)
+{
+	hrtime_t start = gethrtime();
+
+	if ((errno = nvlist_alloc(&g->g_sections[i], NV_UNIQUE_NAME,
+	    0)) != 0) {
+		warn("nvlist_alloc");
+		g->g_sections[i] = NULL;
+		return;
+	}
+	sysinfo_collectors[i].co_func(g->g_ctx, g->g_sections[i]);
+	g->g_times[i] = gethrtime() - start;
+}
+
+static void *
+worker(void *arg)
+{
+	struct gather *g = (struct gather *)arg;
+	int i;
+
+	for (;;) {
+		(void) pthread_mutex_lock(&g->g_lock);
+		i = g->g_next++;
+		(void) pthread_mutex_unlock(&g->g_lock);
+
+		if (i >= g->g_count)
+			break;
+		if ((g->g_want == NULL || g->g_want[i]) && !g->g_boot[i])
+			run_collector(g, i);
+	}
+	return (NULL);
+}
+
+int
+sysinfo_parse_count(const char *s)
+{
+	char *end;
+	long n;
+
+	errno = 0;
+	n = strtol(s, &end, 10);
+	if (errno != 0 || end == s || *end != '\0' || n < 1 || n > INT_MAX)
+		return (-1);
+	return ((int)n);
+}
+
+void
+sysinfo_timing_add(nvlist_t *timing, const char *name, hrtime_t t)
+{
+	if (timing != NULL)
+		fnvlist_add_uint64(timing, name, t / (NANOSEC / MICROSEC));
+}
+
+nvlist_t *
+sysinfo_gather_sections(sysinfo_ctx_t *ctx, int nthreads,
+    const boolean_t *want, nvlist_t *timing)
+{
+	struct gather g;
+	pthread_t *tids = NULL;
+	nvlist_t *sections = NULL;
+	nvlist_t *boot = NULL;
+	nvlist_t *section;
+	int started = 0;
+	hrtime_t start = gethrtime();
+	int i;
+
+	(void) memset(&g, 0, sizeof (g));
+	(void) pthread_mutex_init(&g.g_lock, NULL);
+	g.g_ctx = ctx;
+	g.g_count = sysinfo_collector_count();
+	g.g_want = want;
+
+	if ((g.g_sections = calloc(g.g_count, sizeof (nvlist_t *))) == NULL ||
+	    (g.g_times = calloc(g.g_count, sizeof (hrtime_t))) == NULL ||
+	    (g.g_boot = calloc(g.g_count, sizeof (boolean_t))) == NULL) {
+		warn("calloc");
+		goto done;
+	}
+
+	/*
+	 * take what we can from the boot snapshot.  it is only looked at if
+	 * a boot-scoped collector is wanted at all
+	 */
+	for (i = 0; i < g.g_count; i++) {
+		if (!sysinfo_collectors[i].co_boot ||
+		    (want != NULL && !want[i]))
+			continue;
+		if (boot == NULL && (boot = sysinfo_ctx_boot(ctx)) == NULL)
+			break;
+		if (nvlist_lookup_nvlist(boot, sysinfo_collectors[i].co_name,
+		    &section) == 0) {
+			g.g_sections[i] = fnvlist_dup(section);
+			g.g_boot[i] = B_TRUE;
+		}
+	}
+
+	/* this thread is one of the "nthreads" */
+	if (nthreads > g.g_count)
+		nthreads = g.g_count;
+	if (nthreads > 1 &&
+	    (tids = calloc(nthreads - 1, sizeof (pthread_t))) == NULL) {
+		warn("calloc");
+		goto done;
+	}
+
+	/*
+	 * if a thread can't be created the remaining work is picked up by the
+	 * threads that were, or by this thread below
+	 */
+	for (started = 0; tids != NULL && started < nthreads - 1; started++) {
+		if ((errno = pthread_create(&tids[started], NULL, worker,
+		    &g)) != 0) {
+			warn("pthread_create");
+			break;
+		}
+	}
+	(void) worker(&g);
+	for (i = 0; i < started; i++)
+		(void) pthread_join(tids[i], NULL);
+
+	for (i = 0; i < g.g_count; i++) {
+		if (g.g_sections[i] == NULL || g.g_boot[i])
+			continue;
+		sysinfo_timing_add(timing, sysinfo_collectors[i].co_name,
+		    g.g_times[i]);
+		if (sysinfo_collectors[i].co_boot)
+			sysinfo_ctx_boot_add(ctx, sysinfo_collectors[i].co_name,
+			    g.g_sections[i]);
+	}
+	sysinfo_ctx_boot_sync(ctx);
+	sysinfo_timing_add(timing, "gather", gethrtime() - start);
+
+	if ((errno = nvlist_alloc(&sections, NV_UNIQUE_NAME, 0)) != 0) {
+		warn("nvlist_alloc");
+		sections = NULL;
+		goto done;
+	}
+	for (i = 0; i < g.g_count; i++) {
+		if (g.g_sections[i] != NULL)
+			fnvlist_add_nvlist(sections,
+			    sysinfo_collectors[i].co_name, g.g_sections[i]);
+	}
+
+done:
+	if (g.g_sections != NULL) {
+		for (i = 0; i < g.g_count; i++)
+			nvlist_free(g.g_sections[i]);
+		free(g.g_sections);
+	}
+	free(g.g_times);
+	free(g.g_boot);
+	free(tids);
+	(void) pthread_mutex_destroy(&g.g_lock);
+	return (sections);
+}
+
+int
+sysinfo_refresh_sections(sysinfo_ctx_t *ctx, nvlist_t *sections,
+    int nthreads, const boolean_t *stale, nvlist_t *timing)
+{
+	nvlist_t *fresh;
+	nvpair_t *curr;
+	nvlist_t *section;
+
+	if ((fresh = sysinfo_gather_sections(ctx, nthreads, stale,
+	    timing)) == NULL)
+		return (-1);
+
+	// adding under an existing name replaces the old section
+	for (curr = nvlist_next_nvpair(fresh, NULL); curr;
+	    curr = nvlist_next_nvpair(fresh, curr)) {
+		(void) nvpair_value_nvlist(curr, &section);
+		fnvlist_add_nvlist(sections, nvpair_name(curr), section);
+	}
+
+	nvlist_free(fresh);
+	return (0);
+}
+
+nvlist_t *
+sysinfo_assemble(nvlist_t *sections, nvlist_t *timing)
+{
+	nvlist_t *nvl;
+	nvlist_t *section;
+	hrtime_t start = gethrtime();
+	int i;
+
+	if ((errno = nvlist_alloc(&nvl, NV_UNIQUE_NAME, 0)) != 0) {
+		warn("nvlist_alloc");
+		return (NULL);
+	}
+
+	// XXX this is hardcoded to be true for some reason
+	fnvlist_add_boolean(nvl, "VM Capable");
+
+	/* merge the sections in table order so the output is stable */
+	for (i = 0; sysinfo_collectors[i].co_name != NULL; i++) {
+		if (nvlist_lookup_nvlist(sections,
+		    sysinfo_collectors[i].co_name, &section) == 0)
+			fnvlist_merge(nvl, section);
+	}
+	sysinfo_timing_add(timing, "merge", gethrtime() - start);
+
+	return (nvl);
+}
+
+nvlist_t *
+sysinfo_gather(sysinfo_ctx_t *ctx, int nthreads, const boolean_t *want,
+    nvlist_t *timing)
+{
+	nvlist_t *sections;
+	nvlist_t *nvl;
+
+	if ((sections = sysinfo_gather_sections(ctx, nthreads, want,
+	    timing)) == NULL)
+		return (NULL);
+
+	nvl = sysinfo_assemble(sections, timing);
+	nvlist_free(sections);
+	return (nvl);
+}
+
+nvlist_t *
+sysinfo_select_keys(nvlist_t *nvl, char **keys, int nkeys)
+{
+	nvlist_t *out;
+	nvpair_t *pair;
+	int i;
+
+	out = fnvlist_alloc();
+	for (i = 0; i < nkeys; i++) {
+		if (nvlist_lookup_nvpair(nvl, keys[i], &pair) == 0 &&
+		    !nvlist_exists(out, keys[i]))
+			fnvlist_add_nvpair(out, pair);
+	}
+	return (out);
+}
@@ -0,0 +1,559 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libnvpair.h>
+
+#include "sysinfo.h"
+
+#define	JSON_INDENT	"  "
+
+/*
+ * growable buffer.  an allocation failure is remembered in sb_error and all
+ * later appends are dropped, so callers only need to check once at the end
+ */
+void
+sysinfo_buf_init(sysinfo_buf_t *b)
+{
+	(void) memset(b, 0, sizeof (*b));
+}
+
+void
+sysinfo_buf_free(sysinfo_buf_t *b)
+{
+	free(b->sb_data);
+	sysinfo_buf_init(b);
+}
+
+void
+sysinfo_buf_append(sysinfo_buf_t *b, const char *s, size_t len)
+{
+	size_t size;
+	char *p;
+
+	if (b->sb_error)
+		return;
+
+	if (b->sb_len + len + 1 > b->sb_size) {
+		size = b->sb_size == 0 ? 4096 : b->sb_size;
+		while (b->sb_len + len + 1 > size)
+			size *= 2;
+		if ((p = realloc(b->sb_data, size)) == NULL) {
+			warn("realloc");
+			b->sb_error = B_TRUE;
+			return;
+		}
+		b->sb_data = p;
+		b->sb_size = size;
+	}
+
+	(void) memcpy(b->sb_data + b->sb_len, s, len);
+	b->sb_len += len;
+	b->sb_data[b->sb_len] = '\0';
+}
+
+void
+sysinfo_buf_puts(sysinfo_buf_t *b, const char *s)
+{
+	sysinfo_buf_append(b, s, strlen(s));
+}
+
+void
+sysinfo_json_init(sysinfo_json_t *j, sysinfo_buf_t *b, boolean_t pretty)
+{
+	(void) memset(j, 0, sizeof (*j));
+	j->sj_buf = b;
+	j->sj_pretty = pretty;
+	j->sj_first = B_TRUE;
+}
+
+static void
+newline(sysinfo_json_t *j)
+{
+	int i;
+
+	sysinfo_buf_append(j->sj_buf, "\n", 1);
+	for (i = 0; i < j->sj_depth; i++)
+		sysinfo_buf_puts(j->sj_buf, JSON_INDENT);
+}
+
+/*
+ * called before every key and every value; writes the separator from the
+ * previous element at this depth, unless the value follows its own key
+ */
+static void
+prefix(sysinfo_json_t *j)
+{
+	if (j->sj_key) {
+		j->sj_key = B_FALSE;
+		return;
+	}
+	if (!j->sj_first)
+		sysinfo_buf_append(j->sj_buf, ",", 1);
+	if (j->sj_pretty && j->sj_depth > 0)
+		newline(j);
+	j->sj_first = B_FALSE;
+}
+
+static void
+open_container(sysinfo_json_t *j, char c)
+{
+	prefix(j);
+	sysinfo_buf_append(j->sj_buf, &c, 1);
+	j->sj_depth++;
+	j->sj_first = B_TRUE;
+}
+
+static void
+close_container(sysinfo_json_t *j, char c)
+{
+	j->sj_depth--;
+	if (j->sj_pretty && !j->sj_first)
+		newline(j);
+	sysinfo_buf_append(j->sj_buf, &c, 1);
+	j->sj_first = B_FALSE;
+}
+
+void
+sysinfo_json_begin_object(sysinfo_json_t *j)
+{
+	open_container(j, '{');
+}
+
+void
+sysinfo_json_end_object(sysinfo_json_t *j)
+{
+	close_container(j, '}');
+}
+
+void
+sysinfo_json_begin_array(sysinfo_json_t *j)
+{
+	open_container(j, '[');
+}
+
+void
+sysinfo_json_end_array(sysinfo_json_t *j)
+{
+	close_container(j, ']');
+}
+
+/*
+ * write "s" as a quoted JSON string.  runs of characters that need no
+ * escaping are copied in one go.
+ *
+ * this escapes the way nvlist_print_json does in the C locale (sysinfo
+ * never calls setlocale): there every byte is a character of its own, so
+ * control characters and each byte from 0x80 up are written as \u00XX,
+ * while 0x7f is printable ASCII and written as it is
+ */
+static void
+quote(sysinfo_buf_t *b, const char *s)
+{
+	const char *run = s;
+	char esc[8];
+
+	sysinfo_buf_append(b, "\"", 1);
+	for (; *s != '\0'; s++) {
+		uchar_t c = *s;
+
+		if (c >= 0x20 && c <= 0x7f && c != '"' && c != '\\')
+			continue;
+
+		sysinfo_buf_append(b, run, s - run);
+		run = s + 1;
+		switch (c) {
+		case '"':
+			sysinfo_buf_append(b, "\\\"", 2);
+			break;
+		case '\\':
+			sysinfo_buf_append(b, "\\\\", 2);
+			break;
+		case '\n':
+			sysinfo_buf_append(b, "\\n", 2);
+			break;
+		case '\r':
+			sysinfo_buf_append(b, "\\r", 2);
+			break;
+		case '\t':
+			sysinfo_buf_append(b, "\\t", 2);
+			break;
+		case '\f':
+			sysinfo_buf_append(b, "\\f", 2);
+			break;
+		case '\b':
+			sysinfo_buf_append(b, "\\b", 2);
+			break;
+		default:
+			(void) snprintf(esc, sizeof (esc), "\\u%04x", c);
+			sysinfo_buf_puts(b, esc);
+			break;
+		}
+	}
+	sysinfo_buf_append(b, run, s - run);
+	sysinfo_buf_append(b, "\"", 1);
+}
+
+void
+sysinfo_json_key(sysinfo_json_t *j, const char *key)
+{
+	prefix(j);
+	quote(j->sj_buf, key);
+	if (j->sj_pretty)
+		sysinfo_buf_append(j->sj_buf, ": ", 2);
+	else
+		sysinfo_buf_append(j->sj_buf, ":", 1);
+	j->sj_key = B_TRUE;
+}
+
+void
+sysinfo_json_string(sysinfo_json_t *j, const char *s)
+{
+	prefix(j);
+	quote(j->sj_buf, s);
+}
+
+/*
+ * write a pre-formatted value (a number or a literal) as is
+ */
+void
+sysinfo_json_raw(sysinfo_json_t *j, const char *s, size_t len)
+{
+	prefix(j);
+	sysinfo_buf_append(j->sj_buf, s, len);
+}
+
+void
+sysinfo_json_int(sysinfo_json_t *j, int64_t v)
+{
+	char num[32];
+
+	sysinfo_json_raw(j, num,
+	    snprintf(num, sizeof (num), "%lld", (long long)v));
+}
+
+void
+sysinfo_json_uint(sysinfo_json_t *j, uint64_t v)
+{
+	char num[32];
+
+	sysinfo_json_raw(j, num,
+	    snprintf(num, sizeof (num), "%llu", (unsigned long long)v));
+}
+
+void
+sysinfo_json_double(sysinfo_json_t *j, double v)
+{
+	char num[64];
+
+	sysinfo_json_raw(j, num, snprintf(num, sizeof (num), "%.16g", v));
+}
+
+void
+sysinfo_json_bool(sysinfo_json_t *j, boolean_t v)
+{
+	if (v)
+		sysinfo_json_raw(j, "true", 4);
+	else
+		sysinfo_json_raw(j, "false", 5);
+}
+
+/*
+ * write the value of a single nvpair.  types are rendered the same way
+ * nvlist_print_json does, so switching writers doesn't change the output
+ */
+static void
+json_nvpair(sysinfo_json_t *j, nvpair_t *pair)
+{
+	uint_t i, n;
+
+	switch (nvpair_type(pair)) {
+	case DATA_TYPE_BOOLEAN:
+		sysinfo_json_bool(j, B_TRUE);
+		break;
+	case DATA_TYPE_BOOLEAN_VALUE: {
+		boolean_t v;
+		(void) nvpair_value_boolean_value(pair, &v);
+		sysinfo_json_bool(j, v);
+		break;
+	}
+	case DATA_TYPE_BYTE: {
+		uchar_t v;
+		(void) nvpair_value_byte(pair, &v);
+		sysinfo_json_uint(j, v);
+		break;
+	}
+	case DATA_TYPE_INT8: {
+		int8_t v;
+		(void) nvpair_value_int8(pair, &v);
+		sysinfo_json_int(j, v);
+		break;
+	}
+	case DATA_TYPE_UINT8: {
+		uint8_t v;
+		(void) nvpair_value_uint8(pair, &v);
+		sysinfo_json_uint(j, v);
+		break;
+	}
+	case DATA_TYPE_INT16: {
+		int16_t v;
+		(void) nvpair_value_int16(pair, &v);
+		sysinfo_json_int(j, v);
+		break;
+	}
+	case DATA_TYPE_UINT16: {
+		uint16_t v;
+		(void) nvpair_value_uint16(pair, &v);
+		sysinfo_json_uint(j, v);
+		break;
+	}
+	case DATA_TYPE_INT32: {
+		int32_t v;
+		(void) nvpair_value_int32(pair, &v);
+		sysinfo_json_int(j, v);
+		break;
+	}
+	case DATA_TYPE_UINT32: {
+		uint32_t v;
+		(void) nvpair_value_uint32(pair, &v);
+		sysinfo_json_uint(j, v);
+		break;
+	}
+	case DATA_TYPE_INT64: {
+		int64_t v;
+		(void) nvpair_value_int64(pair, &v);
+		sysinfo_json_int(j, v);
+		break;
+	}
+	case DATA_TYPE_UINT64: {
+		uint64_t v;
+		(void) nvpair_value_uint64(pair, &v);
+		sysinfo_json_uint(j, v);
+		break;
+	}
+	case DATA_TYPE_HRTIME: {
+		hrtime_t v;
+		(void) nvpair_value_hrtime(pair, &v);
+		sysinfo_json_int(j, v);
+		break;
+	}
+	case DATA_TYPE_DOUBLE: {
+		double v;
+		(void) nvpair_value_double(pair, &v);
+		sysinfo_json_double(j, v);
+		break;
+	}
+	case DATA_TYPE_STRING: {
+		char *v;
+		(void) nvpair_value_string(pair, &v);
+		sysinfo_json_string(j, v);
+		break;
+	}
+	case DATA_TYPE_NVLIST: {
+		nvlist_t *v;
+		(void) nvpair_value_nvlist(pair, &v);
+		sysinfo_json_nvlist(j, v);
+		break;
+	}
+	case DATA_TYPE_STRING_ARRAY: {
+		char **v;
+		(void) nvpair_value_string_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_string(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_NVLIST_ARRAY: {
+		nvlist_t **v;
+		(void) nvpair_value_nvlist_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_nvlist(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_BOOLEAN_ARRAY: {
+		boolean_t *v;
+		(void) nvpair_value_boolean_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_bool(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_BYTE_ARRAY: {
+		uchar_t *v;
+		(void) nvpair_value_byte_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_uint(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_INT8_ARRAY: {
+		int8_t *v;
+		(void) nvpair_value_int8_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_int(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_UINT8_ARRAY: {
+		uint8_t *v;
+		(void) nvpair_value_uint8_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_uint(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_INT16_ARRAY: {
+		int16_t *v;
+		(void) nvpair_value_int16_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_int(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_UINT16_ARRAY: {
+		uint16_t *v;
+		(void) nvpair_value_uint16_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_uint(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_INT32_ARRAY: {
+		int32_t *v;
+		(void) nvpair_value_int32_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_int(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_UINT32_ARRAY: {
+		uint32_t *v;
+		(void) nvpair_value_uint32_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_uint(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_INT64_ARRAY: {
+		int64_t *v;
+		(void) nvpair_value_int64_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_int(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	case DATA_TYPE_UINT64_ARRAY: {
+		uint64_t *v;
+		(void) nvpair_value_uint64_array(pair, &v, &n);
+		sysinfo_json_begin_array(j);
+		for (i = 0; i < n; i++)
+			sysinfo_json_uint(j, v[i]);
+		sysinfo_json_end_array(j);
+		break;
+	}
+	default:
+		// not something sysinfo ever produces
+		sysinfo_json_raw(j, "null", 4);
+		break;
+	}
+}
+
+void
+sysinfo_json_nvlist(sysinfo_json_t *j, nvlist_t *nvl)
+{
+	nvpair_t *curr;
+
+	sysinfo_json_begin_object(j);
+	for (curr = nvlist_next_nvpair(nvl, NULL); curr;
+	    curr = nvlist_next_nvpair(nvl, curr)) {
+		sysinfo_json_key(j, nvpair_name(curr));
+		json_nvpair(j, curr);
+	}
+	sysinfo_json_end_object(j);
+}
+
+/*
+ * feed already-rendered compact JSON text (such as the cache contents)
+ * through the writer, which re-indents it when the writer is in pretty
+ * mode.  strings are copied with their escapes intact and numbers and
+ * literals are copied as is, so no values are decoded
+ */
+void
+sysinfo_json_reformat(sysinfo_json_t *j, const char *s, size_t len)
+{
+	const char *end = s + len;
+	const char *p;
+
+	while (s < end) {
+		switch (*s) {
+		case '{':
+			sysinfo_json_begin_object(j);
+			s++;
+			break;
+		case '}':
+			sysinfo_json_end_object(j);
+			s++;
+			break;
+		case '[':
+			sysinfo_json_begin_array(j);
+			s++;
+			break;
+		case ']':
+			sysinfo_json_end_array(j);
+			s++;
+			break;
+		case ',':
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			// separators are written by the writer itself
+			s++;
+			break;
+		case '"':
+			for (p = s + 1; p < end && *p != '"'; p++) {
+				// a backslash can't take the end with it
+				if (*p == '\\' && p + 1 < end)
+					p++;
+			}
+			if (p < end)
+				p++;
+			prefix(j);
+			sysinfo_buf_append(j->sj_buf, s, p - s);
+			s = p;
+
+			// a string followed by a colon is a key
+			while (s < end && (*s == ' ' || *s == '\n'))
+				s++;
+			if (s < end && *s == ':') {
+				if (j->sj_pretty)
+					sysinfo_buf_append(j->sj_buf, ": ", 2);
+				else
+					sysinfo_buf_append(j->sj_buf, ":", 1);
+				j->sj_key = B_TRUE;
+				s++;
+			}
+			break;
+		default:
+			for (p = s; p < end && strchr(",]} \t\r\n", *p) == NULL;
+			    p++)
+				;
+			sysinfo_json_raw(j, s, p - s);
+			s = p;
+			break;
+		}
+	}
+}
@@ -6,7 +6,9 @@
 
 #include <libnvpair.h>
 
-void sysinfo_kstat(nvlist_t *root_nvl) {
+#include "sysinfo.h"
+
+void sysinfo_kstat(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
 	int max_chip_id;
 	int *chips = NULL;
 	kstat_ctl_t	*kc = NULL;
@@ -15,7 +17,7 @@ void sysinfo_kstat(nvlist_t *root_nvl) {
 	int cpus = 0;
 	int i;
 
-	if ((kc = kstat_open()) == NULL)
+	if ((kc = sysinfo_ctx_kstat_hold(ctx)) == NULL)
 		goto done;
 
 	/* get physical core count */
@@ -43,6 +45,6 @@ void sysinfo_kstat(nvlist_t *root_nvl) {
 	fnvlist_add_int32(root_nvl, "CPU Physical Cores", cpus);
 done:
 	if (kc != NULL)
-		(void) kstat_close(kc);
+		sysinfo_ctx_kstat_rele(ctx);
 	free(chips);
 }
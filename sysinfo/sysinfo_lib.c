@@ -0,0 +1,304 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libnvpair.h>
+
+#include "libsysinfo.h"
+#include "sysinfo.h"
+
+/*
+ * the public face of the collectors.  "lock" protects the document from
+ * a swap while it is being read; "gather_lock" serializes gathers, which
+ * are the only writers of "sections" and the only users of "ctx", the
+ * same split sysinfod uses
+ */
+struct sysinfo_hdl {
+	pthread_mutex_t sh_lock;
+	pthread_mutex_t sh_gather_lock;
+	sysinfo_ctx_t *sh_ctx;
+	int sh_nthreads;
+	nvlist_t *sh_sections;
+	nvlist_t *sh_doc;
+};
+
+static pthread_once_t names_once = PTHREAD_ONCE_INIT;
+static const char **collector_names;
+
+static void
+init_names(void)
+{
+	int i, n = sysinfo_collector_count();
+
+	if ((collector_names = calloc(n + 1, sizeof (char *))) == NULL)
+		return;
+	for (i = 0; i < n; i++)
+		collector_names[i] = sysinfo_collectors[i].co_name;
+}
+
+const char * const *
+sysinfo_collector_names(void)
+{
+	(void) pthread_once(&names_once, init_names);
+	return (collector_names);
+}
+
+sysinfo_hdl_t *
+sysinfo_open(int nthreads)
+{
+	sysinfo_hdl_t *h;
+
+	if ((h = calloc(1, sizeof (*h))) == NULL)
+		return (NULL);
+	if ((h->sh_ctx = sysinfo_ctx_create(B_FALSE)) == NULL) {
+		free(h);
+		return (NULL);
+	}
+	(void) pthread_mutex_init(&h->sh_lock, NULL);
+	(void) pthread_mutex_init(&h->sh_gather_lock, NULL);
+	h->sh_nthreads = nthreads < 1 ? 1 : nthreads;
+	return (h);
+}
+
+void
+sysinfo_close(sysinfo_hdl_t *h)
+{
+	if (h == NULL)
+		return;
+
+	sysinfo_ctx_destroy(h->sh_ctx);
+	nvlist_free(h->sh_sections);
+	nvlist_free(h->sh_doc);
+	(void) pthread_mutex_destroy(&h->sh_lock);
+	(void) pthread_mutex_destroy(&h->sh_gather_lock);
+	free(h);
+}
+
+int
+sysinfo_update(sysinfo_hdl_t *h, const char * const *names, int n)
+{
+	boolean_t *want = NULL;
+	nvlist_t *sections = NULL;
+	nvlist_t *doc = NULL;
+	int i, c, err;
+	int ret = -1;
+
+	if (names != NULL) {
+		if ((want = calloc(sysinfo_collector_count(),
+		    sizeof (boolean_t))) == NULL)
+			return (-1);
+		for (i = 0; i < n; i++) {
+			if ((c = sysinfo_collector_lookup(names[i])) < 0) {
+				free(want);
+				errno = ENOENT;
+				return (-1);
+			}
+			want[c] = B_TRUE;
+		}
+	}
+
+	(void) pthread_mutex_lock(&h->sh_gather_lock);
+	sysinfo_ctx_refresh(h->sh_ctx);
+
+	/*
+	 * a partial update is spliced into a copy of the current sections so
+	 * readers never see a half-updated document.  the gather functions
+	 * leave errno set when they fail
+	 */
+	if (want != NULL && h->sh_sections != NULL) {
+		if ((errno = nvlist_dup(h->sh_sections, &sections, 0)) != 0) {
+			sections = NULL;
+			goto done;
+		}
+		if (sysinfo_refresh_sections(h->sh_ctx, sections,
+		    h->sh_nthreads, want, NULL) != 0)
+			goto done;
+	} else if ((sections = sysinfo_gather_sections(h->sh_ctx,
+	    h->sh_nthreads, want, NULL)) == NULL) {
+		goto done;
+	}
+
+	if ((doc = sysinfo_assemble(sections, NULL)) == NULL)
+		goto done;
+
+	(void) pthread_mutex_lock(&h->sh_lock);
+	nvlist_free(h->sh_sections);
+	nvlist_free(h->sh_doc);
+	h->sh_sections = sections;
+	h->sh_doc = doc;
+	(void) pthread_mutex_unlock(&h->sh_lock);
+
+	// now owned by the handle
+	sections = NULL;
+	doc = NULL;
+	ret = 0;
+
+done:
+	err = errno;
+	(void) pthread_mutex_unlock(&h->sh_gather_lock);
+	nvlist_free(sections);
+	nvlist_free(doc);
+	free(want);
+	if (ret != 0)
+		errno = err;
+	return (ret);
+}
+
+int
+sysinfo_refresh(sysinfo_hdl_t *h, const char *name)
+{
+	return (sysinfo_update(h, &name, 1));
+}
+
+nvlist_t *
+sysinfo_nvlist(sysinfo_hdl_t *h)
+{
+	nvlist_t *nvl = NULL;
+	int err;
+
+	(void) pthread_mutex_lock(&h->sh_lock);
+	if (h->sh_doc == NULL) {
+		errno = ENOENT;
+	} else if ((err = nvlist_dup(h->sh_doc, &nvl, 0)) != 0) {
+		errno = err;
+		nvl = NULL;
+	}
+	(void) pthread_mutex_unlock(&h->sh_lock);
+	return (nvl);
+}
+
+/*
+ * find "key" in the current document.  called, and the pair used, with
+ * sh_lock held
+ */
+static nvpair_t *
+lookup(sysinfo_hdl_t *h, const char *key)
+{
+	nvpair_t *pair;
+
+	if (h->sh_doc == NULL || nvlist_lookup_nvpair(h->sh_doc, key,
+	    &pair) != 0) {
+		errno = ENOENT;
+		return (NULL);
+	}
+	return (pair);
+}
+
+int
+sysinfo_get_string(sysinfo_hdl_t *h, const char *key, char **valp)
+{
+	nvpair_t *pair;
+	char *s;
+	int ret = -1;
+
+	(void) pthread_mutex_lock(&h->sh_lock);
+	if ((pair = lookup(h, key)) == NULL)
+		goto done;
+	if (nvpair_value_string(pair, &s) != 0) {
+		errno = EINVAL;
+		goto done;
+	}
+	if ((*valp = strdup(s)) == NULL)
+		goto done;
+	ret = 0;
+
+done:
+	(void) pthread_mutex_unlock(&h->sh_lock);
+	return (ret);
+}
+
+int
+sysinfo_get_int(sysinfo_hdl_t *h, const char *key, int64_t *valp)
+{
+	nvpair_t *pair;
+	int8_t i8;
+	uint8_t u8;
+	int16_t i16;
+	uint16_t u16;
+	int32_t i32;
+	uint32_t u32;
+	int64_t i64;
+	uint64_t u64;
+	int ret = 0;
+
+	(void) pthread_mutex_lock(&h->sh_lock);
+	if ((pair = lookup(h, key)) == NULL) {
+		ret = -1;
+		goto done;
+	}
+
+	switch (nvpair_type(pair)) {
+	case DATA_TYPE_INT8:
+		(void) nvpair_value_int8(pair, &i8);
+		*valp = i8;
+		break;
+	case DATA_TYPE_UINT8:
+		(void) nvpair_value_uint8(pair, &u8);
+		*valp = u8;
+		break;
+	case DATA_TYPE_INT16:
+		(void) nvpair_value_int16(pair, &i16);
+		*valp = i16;
+		break;
+	case DATA_TYPE_UINT16:
+		(void) nvpair_value_uint16(pair, &u16);
+		*valp = u16;
+		break;
+	case DATA_TYPE_INT32:
+		(void) nvpair_value_int32(pair, &i32);
+		*valp = i32;
+		break;
+	case DATA_TYPE_UINT32:
+		(void) nvpair_value_uint32(pair, &u32);
+		*valp = u32;
+		break;
+	case DATA_TYPE_INT64:
+		(void) nvpair_value_int64(pair, &i64);
+		*valp = i64;
+		break;
+	case DATA_TYPE_UINT64:
+		(void) nvpair_value_uint64(pair, &u64);
+		*valp = u64;
+		break;
+	default:
+		errno = EINVAL;
+		ret = -1;
+		break;
+	}
+
+done:
+	(void) pthread_mutex_unlock(&h->sh_lock);
+	return (ret);
+}
+
+int
+sysinfo_get_boolean(sysinfo_hdl_t *h, const char *key, boolean_t *valp)
+{
+	nvpair_t *pair;
+	int ret = 0;
+
+	(void) pthread_mutex_lock(&h->sh_lock);
+	if ((pair = lookup(h, key)) == NULL) {
+		ret = -1;
+		goto done;
+	}
+
+	switch (nvpair_type(pair)) {
+	case DATA_TYPE_BOOLEAN:
+		// a boolean with no value (like "VM Capable") is true
+		*valp = B_TRUE;
+		break;
+	case DATA_TYPE_BOOLEAN_VALUE:
+		(void) nvpair_value_boolean_value(pair, valp);
+		break;
+	default:
+		errno = EINVAL;
+		ret = -1;
+		break;
+	}
+
+done:
+	(void) pthread_mutex_unlock(&h->sh_lock);
+	return (ret);
+}
@@ -15,72 +15,41 @@
 
 #include <libnictag.h>
 
+#include "sysinfo.h"
+
 static struct sysinfonet {
-	nvlist_t *nictags;
+	sysinfo_ctx_t *ctx;
+	nictag_index_t *nictags;
 	nvlist_t *ret;
 };
 
-static void
-mac2str(const unsigned char *macaddr, char *buf)
-{
-	int i, n;
-	n = sprintf(buf, "%02x", *macaddr++);
-	for (i = 0; i < (ETHERADDRL - 1); i++)
-		n += sprintf(buf+n, ":%02x", *macaddr++);
-}
-
-static boolean_t
-str2mac(const char *buf, unsigned int **macaddr)
-{
-	return sscanf(buf, "%x:%x:%x:%x:%x:%x%c",
-		macaddr[0],
-		macaddr[1],
-		macaddr[2],
-		macaddr[3],
-		macaddr[4],
-		macaddr[5]) == 6 ? B_TRUE : B_FALSE;
-}
-
 static boolean_t
 phys_macaddr(void *arg, dladm_macaddr_attr_t *attr)
 {
 	struct sysinfonet *oo = (struct sysinfonet *)arg;
 	nvlist_t *int_nvl = oo->ret;
-	nvlist_t *nictags = oo->nictags;
-	nvpair_t *curr;
-	char macstr[ETHERADDRL * 3];
+	char macstr[NICTAG_MACSTRLEN];
+	char *none[1];
 	char **tags;
-	int i = 0;
+	uint_t ntags;
 
-	tags = malloc(sizeof (char *) * 1024);
-	if (tags == NULL)
-		return B_TRUE; // TODO better error handling
+	if (attr->ma_addrlen != ETHERADDRL)
+		return B_TRUE;
 
-	mac2str(attr->ma_addr, macstr);
+	nictag_mac2str(attr->ma_addr, macstr);
 	fnvlist_add_string(int_nvl, "MAC Address", macstr);
 
-	// loop each nic tag and find all the relevant ones
-	// TODO normalize macs in libnictag
-	for (curr = nvlist_next_nvpair(nictags, NULL); curr;
-	    curr = nvlist_next_nvpair(nictags, curr)) {
-		char *name = nvpair_name(curr);
-		char *mac;
-		nvpair_value_string(curr, &mac);
-
-		if (strcmp(mac, macstr) == 0) {
-			// match
-			tags[i] = name;
-			if (++i == 1024)
-				return B_TRUE; // TODO better error handling
-		}
-	}
-	fnvlist_add_string_array(int_nvl, "NIC Names", tags, i);
+	// every nic tag on this mac, straight from the index
+	if ((tags = nictag_index_lookup(oo->nictags, attr->ma_addr,
+	    &ntags)) == NULL)
+		tags = none;
+	fnvlist_add_string_array(int_nvl, "NIC Names", tags, ntags);
 
 	return B_TRUE;
 }
 
 static void
-get_link_state(char *link, nvlist_t *nvl)
+get_link_state(sysinfo_ctx_t *ctx, char *link, nvlist_t *nvl)
 {
 	kstat_ctl_t	*kcp;
 	kstat_t		*ksp;
@@ -88,8 +57,9 @@ get_link_state(char *link, nvlist_t *nvl)
 	uint32_t linkstate;
 	char linkstate_str[256];
 
-	if ((kcp = kstat_open()) == NULL)
-		goto done;
+	// one chain for every link, rather than a kstat_open(3KSTAT) per link
+	if ((kcp = sysinfo_ctx_kstat_hold(ctx)) == NULL)
+		return;
 
 	if ((ksp = kstat_lookup(kcp, "link", 0, link)) == NULL)
 		goto done;
@@ -105,7 +75,7 @@ get_link_state(char *link, nvlist_t *nvl)
 
 	fnvlist_add_string(nvl, "Link Status", linkstate_str);
 done:
-	kstat_close(kcp);
+	sysinfo_ctx_kstat_rele(ctx);
 }
 
 static int
@@ -133,12 +103,13 @@ show_phys(dladm_handle_t handle, datalink_id_t linkid, void *arg)
 	if (class != DATALINK_CLASS_PHYS)
 		goto done;
 
+	oo.ctx = o->ctx;
 	oo.ret = int_nvl;
 	oo.nictags = o->nictags;
 	dladm_walk_macaddr(handle, linkid, &oo, phys_macaddr);
 
 	/* get link state */
-	get_link_state(link, int_nvl);
+	get_link_state(o->ctx, link, int_nvl);
 
 done:
 	nvlist_add_nvlist(net_nvl, link, int_nvl);
@@ -146,38 +117,35 @@ done:
 	return (DLADM_WALK_CONTINUE);
 }
 
-static nvlist_t *
+static nictag_index_t *
 get_nictags()
 {
-	char *buf;
-	nvlist_t *config;
+	nictag_config_t *config;
 	nvlist_t *nictags;
+	nictag_index_t *index;
 
-	buf = nictag_read_config();
-	if (buf == NULL)
+	if ((config = nictag_config_open(NULL)) == NULL)
 		return NULL;
 
-	config = nictag_parse_config(buf);
-	if (config == NULL) {
-		free(buf);
+	nictags = nictag_config_tags(config);
+	nictag_config_close(config);
+	if (nictags == NULL)
 		return NULL;
-	}
-	free(buf);
 
-	nictags = nictag_get_tags(config);
-	nvlist_free(config);
-	return nictags;
+	index = nictag_index_create(nictags);
+	nvlist_free(nictags);
+	return index;
 }
 
 void
-sysinfo_network(nvlist_t *root_nvl)
+sysinfo_network(sysinfo_ctx_t *ctx, nvlist_t *root_nvl)
 {
 	nvlist_t *net_nvl = NULL;
 	nvlist_t *int_nvl = NULL;
-	dladm_handle_t handle = NULL;
+	dladm_handle_t handle;
 	uint32_t	flags = DLADM_OPT_ACTIVE;
 	struct ifaddrs *ifap, *ifa;
-	nvlist_t *nictags = NULL;
+	nictag_index_t *nictags = NULL;
 	struct sysinfonet o;
 
 	if ((nictags = get_nictags()) == NULL) {
@@ -185,7 +153,7 @@ sysinfo_network(nvlist_t *root_nvl)
 		goto done;
 	}
 
-	if (dladm_open(&handle) != DLADM_STATUS_OK)
+	if ((handle = sysinfo_ctx_dladm(ctx)) == NULL)
 		goto done;
 
 	net_nvl = fnvlist_alloc();
@@ -194,6 +162,7 @@ sysinfo_network(nvlist_t *root_nvl)
 	 * get interfaces and mac addresses (dladm show-phys -m)
 	 * effectively
 	 */
+	o.ctx = ctx;
 	o.nictags = nictags;
 	o.ret = net_nvl;
 	dladm_walk_datalink_id(show_phys, handle, &o,
@@ -218,7 +187,5 @@ sysinfo_network(nvlist_t *root_nvl)
 
 done:
 	nvlist_free(net_nvl);
-	nvlist_free(nictags);
-	if (handle)
-		dladm_close(handle);
+	nictag_index_free(nictags);
 }
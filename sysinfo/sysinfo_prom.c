@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <libnvpair.h>
+
+#include "sysinfo.h"
+
+/*
+ * the document in the Prometheus text exposition format.  numeric keys
+ * become samples, labelled by the pool, disk or link they belong to, and
+ * the strings that identify the host are labels on "sysinfo_info", which is
+ * always 1 (join on it to label the other metrics)
+ */
+
+/* top-level strings carried as labels on sysinfo_info */
+static const struct {
+	const char *pl_key;
+	const char *pl_label;
+} info_labels[] = {
+	{ "Hostname", "hostname" },
+	{ "UUID", "uuid" },
+	{ "System Type", "system_type" },
+	{ "Live Image", "live_image" },
+	{ "SDC Version", "sdc_version" },
+	{ "Manufacturer", "manufacturer" },
+	{ "Product", "product" },
+	{ "Serial Number", "serial_number" },
+	{ "CPU Type", "cpu_type" },
+	{ NULL, NULL }
+};
+
+/* top-level numbers, one sample each */
+static const struct {
+	const char *pg_key;
+	const char *pg_name;
+	const char *pg_help;
+} gauges[] = {
+	{ "MiB of Memory", "sysinfo_memory_mib",
+	    "Physical memory in MiB." },
+	{ "CPU Physical Cores", "sysinfo_cpu_physical_cores",
+	    "Number of physical CPU packages." },
+	{ "CPU Total Cores", "sysinfo_cpu_total_cores",
+	    "Number of CPU cores." },
+	{ "Boot Time", "sysinfo_boot_time_seconds",
+	    "Time the system booted, in seconds since the epoch." },
+	{ "Zpool Size in GiB", "sysinfo_system_zpool_size_gib",
+	    "Size of the system zpool in GiB." },
+	{ NULL, NULL, NULL }
+};
+
+static void
+header(sysinfo_buf_t *b, const char *name, const char *type,
+    const char *help)
+{
+	sysinfo_buf_puts(b, "# HELP ");
+	sysinfo_buf_puts(b, name);
+	sysinfo_buf_append(b, " ", 1);
+	sysinfo_buf_puts(b, help);
+	sysinfo_buf_puts(b, "\n# TYPE ");
+	sysinfo_buf_puts(b, name);
+	sysinfo_buf_append(b, " ", 1);
+	sysinfo_buf_puts(b, type);
+	sysinfo_buf_append(b, "\n", 1);
+}
+
+/*
+ * write a label value.  only backslash, double quote and newline need
+ * escaping in the text format
+ */
+static void
+label_value(sysinfo_buf_t *b, const char *s)
+{
+	const char *p;
+
+	for (p = s; *p != '\0'; p++) {
+		switch (*p) {
+		case '\\':
+			sysinfo_buf_puts(b, "\\\\");
+			break;
+		case '"':
+			sysinfo_buf_puts(b, "\\\"");
+			break;
+		case '\n':
+			sysinfo_buf_puts(b, "\\n");
+			break;
+		default:
+			sysinfo_buf_append(b, p, 1);
+			break;
+		}
+	}
+}
+
+/*
+ * write one sample.  "labels" is NULL or a NULL-terminated list of label
+ * name and value pairs
+ */
+static void
+sample(sysinfo_buf_t *b, const char *name, const char * const *labels,
+    const char *value)
+{
+	int i;
+
+	sysinfo_buf_puts(b, name);
+	if (labels != NULL && labels[0] != NULL) {
+		sysinfo_buf_append(b, "{", 1);
+		for (i = 0; labels[i] != NULL; i += 2) {
+			if (i > 0)
+				sysinfo_buf_append(b, ",", 1);
+			sysinfo_buf_puts(b, labels[i]);
+			sysinfo_buf_puts(b, "=\"");
+			label_value(b, labels[i + 1]);
+			sysinfo_buf_append(b, "\"", 1);
+		}
+		sysinfo_buf_append(b, "}", 1);
+	}
+	sysinfo_buf_append(b, " ", 1);
+	sysinfo_buf_puts(b, value);
+	sysinfo_buf_append(b, "\n", 1);
+}
+
+/*
+ * format an integer (or boolean) pair as a sample value.  returns -1 if
+ * the pair isn't a number
+ */
+static int
+number(nvpair_t *pair, char *buf, size_t len)
+{
+	int32_t i32;
+	uint32_t u32;
+	int64_t i64;
+	uint64_t u64;
+	boolean_t bv;
+
+	switch (nvpair_type(pair)) {
+	case DATA_TYPE_INT32:
+		(void) nvpair_value_int32(pair, &i32);
+		(void) snprintf(buf, len, "%d", i32);
+		break;
+	case DATA_TYPE_UINT32:
+		(void) nvpair_value_uint32(pair, &u32);
+		(void) snprintf(buf, len, "%u", u32);
+		break;
+	case DATA_TYPE_INT64:
+		(void) nvpair_value_int64(pair, &i64);
+		(void) snprintf(buf, len, "%lld", (long long)i64);
+		break;
+	case DATA_TYPE_UINT64:
+		(void) nvpair_value_uint64(pair, &u64);
+		(void) snprintf(buf, len, "%llu", (unsigned long long)u64);
+		break;
+	case DATA_TYPE_BOOLEAN_VALUE:
+		(void) nvpair_value_boolean_value(pair, &bv);
+		(void) snprintf(buf, len, "%d", bv ? 1 : 0);
+		break;
+	default:
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+lookup_number(nvlist_t *nvl, const char *key, char *buf, size_t len)
+{
+	nvpair_t *pair;
+
+	if (nvlist_lookup_nvpair(nvl, key, &pair) != 0)
+		return (-1);
+	return (number(pair, buf, len));
+}
+
+static void
+info(sysinfo_buf_t *b, nvlist_t *doc)
+{
+	const char *labels[2 * (sizeof (info_labels) /
+	    sizeof (info_labels[0]))];
+	char *s;
+	int i, n = 0;
+
+	for (i = 0; info_labels[i].pl_key != NULL; i++) {
+		if (nvlist_lookup_string(doc, info_labels[i].pl_key, &s) != 0)
+			continue;
+		labels[n++] = info_labels[i].pl_label;
+		labels[n++] = s;
+	}
+	labels[n] = NULL;
+
+	header(b, "sysinfo_info", "gauge",
+	    "Identifying strings of the system, always 1.");
+	sample(b, "sysinfo_info", labels, "1");
+}
+
+/*
+ * one sample per member of the nvlist "key" in "doc" that has a numeric
+ * "field", labelled with the member's name
+ */
+static void
+per_member(sysinfo_buf_t *b, nvlist_t *doc, const char *key,
+    const char *field, const char *label, const char *name,
+    const char *help)
+{
+	const char *labels[3] = { label, NULL, NULL };
+	nvlist_t *nvl, *member;
+	nvpair_t *pair;
+	char value[32];
+
+	if (nvlist_lookup_nvlist(doc, key, &nvl) != 0)
+		return;
+
+	header(b, name, "gauge", help);
+	for (pair = nvlist_next_nvpair(nvl, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(nvl, pair)) {
+		if (nvpair_value_nvlist(pair, &member) != 0 ||
+		    lookup_number(member, field, value, sizeof (value)) != 0)
+			continue;
+		labels[1] = nvpair_name(pair);
+		sample(b, name, labels, value);
+	}
+}
+
+/*
+ * a link whose state is neither "up" nor "down" is left out rather than
+ * reported as down
+ */
+static void
+links(sysinfo_buf_t *b, nvlist_t *doc)
+{
+	const char *labels[3] = { "link", NULL, NULL };
+	nvlist_t *nvl, *link;
+	nvpair_t *pair;
+	const char *value;
+	char *state;
+
+	if (nvlist_lookup_nvlist(doc, "Network Interfaces", &nvl) != 0)
+		return;
+
+	header(b, "sysinfo_link_up", "gauge",
+	    "Whether the link is up (1) or not (0).");
+	for (pair = nvlist_next_nvpair(nvl, NULL); pair != NULL;
+	    pair = nvlist_next_nvpair(nvl, pair)) {
+		if (nvpair_value_nvlist(pair, &link) != 0 ||
+		    nvlist_lookup_string(link, "Link Status", &state) != 0)
+			continue;
+		if (strcmp(state, "up") == 0)
+			value = "1";
+		else if (strcmp(state, "down") == 0)
+			value = "0";
+		else
+			continue;
+		labels[1] = nvpair_name(pair);
+		sample(b, "sysinfo_link_up", labels, value);
+	}
+}
+
+static void
+vdev_errors(sysinfo_buf_t *b, nvlist_t *doc)
+{
+	static const struct {
+		const char *ve_key;
+		const char *ve_type;
+	} errors[] = {
+		{ "Read Errors", "read" },
+		{ "Write Errors", "write" },
+		{ "Checksum Errors", "checksum" },
+		{ NULL, NULL }
+	};
+	const char *labels[7] = { "pool", NULL, "vdev", NULL, "type", NULL,
+	    NULL };
+	nvlist_t *health, *pool, *vdevs, *vdev;
+	nvpair_t *pp, *vp;
+	char value[32];
+	int i;
+
+	if (nvlist_lookup_nvlist(doc, "Zpool Health", &health) != 0)
+		return;
+
+	header(b, "sysinfo_zpool_vdev_errors_total", "counter",
+	    "I/O errors seen on the vdev since the pool was imported.");
+	for (pp = nvlist_next_nvpair(health, NULL); pp != NULL;
+	    pp = nvlist_next_nvpair(health, pp)) {
+		if (nvpair_value_nvlist(pp, &pool) != 0 ||
+		    nvlist_lookup_nvlist(pool, "Vdevs", &vdevs) != 0)
+			continue;
+		labels[1] = nvpair_name(pp);
+		for (vp = nvlist_next_nvpair(vdevs, NULL); vp != NULL;
+		    vp = nvlist_next_nvpair(vdevs, vp)) {
+			if (nvpair_value_nvlist(vp, &vdev) != 0)
+				continue;
+			labels[3] = nvpair_name(vp);
+			for (i = 0; errors[i].ve_key != NULL; i++) {
+				if (lookup_number(vdev, errors[i].ve_key,
+				    value, sizeof (value)) != 0)
+					continue;
+				labels[5] = errors[i].ve_type;
+				sample(b, "sysinfo_zpool_vdev_errors_total",
+				    labels, value);
+			}
+		}
+	}
+}
+
+/*
+ * the time each collector took, for the collectors that ran in this
+ * invocation (a collector answered from the cache or the boot snapshot
+ * has no entry in "timing")
+ */
+static void
+durations(sysinfo_buf_t *b, nvlist_t *timing)
+{
+	const char *labels[3] = { "collector", NULL, NULL };
+	char value[32];
+	uint64_t usecs;
+	boolean_t first = B_TRUE;
+	int i, n = sysinfo_collector_count();
+
+	if (timing == NULL)
+		return;
+
+	for (i = 0; i < n; i++) {
+		if (nvlist_lookup_uint64(timing, sysinfo_collectors[i].co_name,
+		    &usecs) != 0)
+			continue;
+		if (first) {
+			header(b, "sysinfo_collector_duration_seconds",
+			    "gauge", "Time spent running the collector.");
+			first = B_FALSE;
+		}
+		(void) snprintf(value, sizeof (value), "%llu.%06llu",
+		    (unsigned long long)(usecs / MICROSEC),
+		    (unsigned long long)(usecs % MICROSEC));
+		labels[1] = sysinfo_collectors[i].co_name;
+		sample(b, "sysinfo_collector_duration_seconds", labels, value);
+	}
+}
+
+void
+sysinfo_prom(sysinfo_buf_t *b, nvlist_t *doc, nvlist_t *timing)
+{
+	char value[32];
+	int i;
+
+	info(b, doc);
+
+	for (i = 0; gauges[i].pg_key != NULL; i++) {
+		if (lookup_number(doc, gauges[i].pg_key, value,
+		    sizeof (value)) != 0)
+			continue;
+		header(b, gauges[i].pg_name, "gauge", gauges[i].pg_help);
+		sample(b, gauges[i].pg_name, NULL, value);
+	}
+
+	per_member(b, doc, "Zpools", "Size in GiB", "pool",
+	    "sysinfo_zpool_size_gib", "Size of the zpool in GiB.");
+	vdev_errors(b, doc);
+	per_member(b, doc, "Disks", "Size in GB", "disk",
+	    "sysinfo_disk_size_gb", "Size of the disk in GB.");
+	links(b, doc);
+	durations(b, timing);
+}
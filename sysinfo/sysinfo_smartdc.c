@@ -7,7 +7,9 @@
 
 #include <libnvpair.h>
 
-void sysinfo_smartdc(nvlist_t *root_nvl) {
+#include "sysinfo.h"
+
+void sysinfo_smartdc(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
 	FILE *f;
 	char version[256];
 
@@ -4,6 +4,8 @@
 
 #include <libnvpair.h>
 
+#include "sysinfo.h"
+
 static void do_system_common(smbios_info_t *info, nvlist_t *nvl) {
 	if (info->smbi_manufacturer[0] != '\0')
 		fnvlist_add_string(nvl, "Manufacturer", info->smbi_manufacturer);
@@ -89,7 +91,7 @@ static int do_struct(smbios_hdl_t *shp, const smbios_struct_t *sp, void *arg) {
 	return 0;
 }
 
-void sysinfo_smbios(nvlist_t *root_nvl) {
+void sysinfo_smbios(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
 	smbios_hdl_t *shp;
 	int err;
 
@@ -5,7 +5,9 @@
 
 #include <libnvpair.h>
 
-void sysinfo_sysconf(nvlist_t *root_nvl) {
+#include "sysinfo.h"
+
+void sysinfo_sysconf(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
 	long pagesize = sysconf(_SC_PAGESIZE);
 	long npages = sysconf(_SC_PHYS_PAGES);
 	int mb = pagesize * npages / 1024 / 1024;
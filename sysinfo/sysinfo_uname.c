@@ -5,9 +5,10 @@
 
 #include <libnvpair.h>
 
-void sysinfo_uname(nvlist_t *root_nvl) {
+#include "sysinfo.h"
+
+void sysinfo_uname(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
 	struct utsname buf;
-	char *image;
 
 	if (uname(&buf) == -1) {
 		warn("uname(2)");
@@ -16,8 +17,35 @@ void sysinfo_uname(nvlist_t *root_nvl) {
 
 	fnvlist_add_string(root_nvl, "System Type", buf.sysname);
 	fnvlist_add_string(root_nvl, "Hostname", buf.nodename);
+}
+
+/*
+ * the platform image is part of the kernel version (joyent_<image>), which
+ * unlike the hostname is fixed for the life of a boot
+ */
+void sysinfo_image(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
+	struct utsname buf;
+	char *image, *lasts;
+
+	if (uname(&buf) == -1) {
+		warn("uname(2)");
+		return;
+	}
+
+	(void) strtok_r(buf.version, "_", &lasts);
+	if ((image = strtok_r(NULL, "_", &lasts)) != NULL)
+		fnvlist_add_string(root_nvl, "Live Image", image);
+}
+
+/*
+ * the hostname is the only part of the output that can change without a
+ * reboot
+ */
+uint64_t sysinfo_uname_stamp(void) {
+	struct utsname buf;
 
-	(void) strtok(buf.version, "_");
-	image = strtok(NULL, "_");
-	fnvlist_add_string(root_nvl, "Live Image", image);
+	if (uname(&buf) == -1)
+		return (0);
+	return (sysinfo_fnv(buf.nodename, strlen(buf.nodename),
+	    SYSINFO_FNV_INIT));
 }
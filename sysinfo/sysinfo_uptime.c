@@ -1,49 +1,43 @@
 #include <err.h>
+#include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 #include <utmpx.h>
-#include <sys/stat.h>
 #include <time.h>
 
 #include <libnvpair.h>
 
+#include "sysinfo.h"
+
+/* the utmpx functions keep their position in the file in a global */
+static pthread_mutex_t utmpx_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
- * most of this lifted from w.c
+ * the kernel keeps the boot time in a kstat, which costs one lookup no
+ * matter how busy the host has been.  if that can't be read, fall back to
+ * the BOOT_TIME record in utmpx (the way w(1) does it), stopping at the
+ * first one instead of reading the whole file: it is written at boot, so
+ * it is near the start no matter how much login churn followed
  */
-void sysinfo_uptime(nvlist_t *root_nvl) {
-	struct stat sbuf;
-	int entries;
-	size_t size;
-	struct utmpx *ut, *utmpbegin, *utmpend, *utp;
+void sysinfo_uptime(sysinfo_ctx_t *ctx, nvlist_t *root_nvl) {
+	struct utmpx *utp;
+	uint64_t t;
 
-	/*
-	 * read the UTMPX_FILE (contains information about each logged in user)
-	 */
-	if (stat(UTMPX_FILE, &sbuf) != 0) {
-		warn("stat(%s)", UTMPX_FILE);
-		return;
-	}
-	entries = sbuf.st_size / sizeof (struct futmpx);
-	size = sizeof (struct utmpx) * entries;
-	if ((ut = malloc(size)) == NULL) {
-		warn("malloc");
+	if ((t = sysinfo_boot_time(ctx)) != 0) {
+		fnvlist_add_int32(root_nvl, "Boot Time", (int32_t)t);
 		return;
 	}
 
+	(void) pthread_mutex_lock(&utmpx_lock);
 	(void) utmpxname(UTMPX_FILE);
 
-	utmpbegin = ut;
-	utmpend = (struct utmpx *)((char *)utmpbegin + size);
-
 	setutxent();
-	while ((ut < utmpend) && ((utp = getutxent()) != NULL))
-		(void) memcpy(ut++, utp, sizeof (*ut));
-	endutxent();
-
-	for (ut = utmpbegin; ut < utmpend; ut++) {
-		if (ut->ut_type != BOOT_TIME)
-			continue;
-		fnvlist_add_int32(root_nvl, "Boot Time", ut->ut_xtime);
-		return;
+	while ((utp = getutxent()) != NULL) {
+		if (utp->ut_type == BOOT_TIME) {
+			fnvlist_add_int32(root_nvl, "Boot Time", utp->ut_xtime);
+			break;
+		}
 	}
+	endutxent();
+	(void) pthread_mutex_unlock(&utmpx_lock);
 }
@@ -9,6 +9,8 @@
 #include <libnvpair.h>
 #include <libzfs.h>
 
+#include "sysinfo.h"
+
 static char *smartdc_fmri = "system/smartdc/init";
 
 static void
@@ -69,31 +71,90 @@ done:
 	scf_handle_destroy(h);
 }
 
+/*
+ * a growable list of vdev names, each allocated by zpool_vdev_name()
+ */
+struct vdev_names {
+	char **vn_names;
+	uint_t vn_count;
+	uint_t vn_size;
+};
+
+static void
+vdev_names_add(struct vdev_names *vn, char *name)
+{
+	char **names;
+
+	if (vn->vn_count == vn->vn_size) {
+		vn->vn_size = vn->vn_size == 0 ? 16 : vn->vn_size * 2;
+		if ((names = realloc(vn->vn_names,
+		    vn->vn_size * sizeof (char *))) == NULL) {
+			warn("realloc");
+			free(name);
+			return;
+		}
+		vn->vn_names = names;
+	}
+	vn->vn_names[vn->vn_count++] = name;
+}
+
 static void
-recurse(nvlist_t *nvl, zpool_handle_t *zp, libzfs_handle_t *zh, char *alldevices)
+vdev_names_free(struct vdev_names *vn)
+{
+	uint_t i;
+
+	for (i = 0; i < vn->vn_count; i++)
+		free(vn->vn_names[i]);
+	free(vn->vn_names);
+	(void) memset(vn, 0, sizeof (*vn));
+}
+
+/*
+ * walk the pool state and handles shared by every pool
+ */
+struct zfs_walk {
+	libzfs_handle_t *zw_zh;
+	const char *zw_syspool;		/* the pool smartdc uses */
+	nvlist_t *zw_root;
+	nvlist_t *zw_pools;
+	nvlist_t *zw_health;
+};
+
+/*
+ * add the names of the leaf devices under "nvl" to "vn", and to the comma
+ * separated list in "buf" if it isn't NULL
+ */
+static void
+recurse(nvlist_t *nvl, zpool_handle_t *zp, libzfs_handle_t *zh,
+    struct vdev_names *vn, sysinfo_buf_t *buf)
 {
 	nvlist_t **child;
 	uint_t c, children;
 	if (nvlist_lookup_nvlist_array(nvl, ZPOOL_CONFIG_CHILDREN, &child, &children) != 0)
 		children = 0;
 
+	if (children == 0) {
+		char *vname = zpool_vdev_name(zh, zp, nvl, B_TRUE);
+
+		if (vname == NULL)
+			return;
+		if (buf != NULL) {
+			if (buf->sb_len > 0)
+				sysinfo_buf_append(buf, ",", 1);
+			sysinfo_buf_puts(buf, vname);
+		}
+		vdev_names_add(vn, vname);
+		return;
+	}
+
 	for (c = 0; c < children; c++) {
-		uint64_t islog = B_FALSE, ishole = B_FALSE;
-		char *vname;
+		uint64_t ishole = B_FALSE;
 
-		/* Don't print logs or holes here */
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG, &islog);
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE, &ishole);
-		if (islog || ishole)
+		if (ishole)
 			continue;
 
-		vname = zpool_vdev_name(zh, zp, child[c], B_TRUE);
-		if (alldevices[0] == '\0')
-			snprintf(alldevices, 2048, "%s", vname);
-		else
-			snprintf(alldevices, 2048, ",%s", vname);
-		recurse(child[c], zp, zh, alldevices);
-		free(vname);
+		recurse(child[c], zp, zh, vn, buf);
 	}
 }
 
@@ -109,79 +170,300 @@ get_zpool_profile(nvlist_t *nvl)
 	if (children < 1)
 		return NULL;
 
-	nvlist_lookup_string(child[0], ZPOOL_CONFIG_TYPE, &profile);
+	if (nvlist_lookup_string(child[0], ZPOOL_CONFIG_TYPE, &profile) != 0)
+		return NULL;
 	if (strcmp(profile, "disk") == 0)
 		profile = "striped";
 	return profile;
 }
 
-void
-sysinfo_zfs(nvlist_t *root_nvl)
+/*
+ * add the top-level vdevs of one class (data or log) to "pool_nvl" as an
+ * array of {"Name", "Type", "Devices"} under "key".  the leaves of the data
+ * vdevs are also added to "disks"
+ */
+static void
+add_vdevs(nvlist_t *pool_nvl, const char *key, nvlist_t *nvroot,
+    zpool_handle_t *zp, libzfs_handle_t *zh, boolean_t logs,
+    sysinfo_buf_t *disks)
 {
-	char zpool[2048];
-	libzfs_handle_t *zh;
-	zpool_handle_t *zp;
-	zfs_handle_t *zds;
-	nvlist_t *config;
-	nvlist_t *nvroot;
-	int size = 0;
-	char alldevices[2048];
+	nvlist_t **child;
+	nvlist_t **groups;
+	uint_t c, children;
+	uint_t n = 0;
+	struct vdev_names vn;
+	char *name, *type;
 
-	get_zpool_name(zpool, sizeof (zpool));
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN, &child,
+	    &children) != 0 || children == 0)
+		return;
+	if ((groups = calloc(children, sizeof (nvlist_t *))) == NULL) {
+		warn("calloc");
+		return;
+	}
 
-	fnvlist_add_string(root_nvl, "Zpool", zpool);
+	for (c = 0; c < children; c++) {
+		uint64_t islog = B_FALSE, ishole = B_FALSE;
 
-	//XX
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
+		    &islog);
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
+		    &ishole);
+		if (ishole || (islog != 0) != logs)
+			continue;
 
-	/* get ZFS and zpool information */
-	if ((zh = libzfs_init()) == NULL) {
-		warn("libzfs_init");
-		return;
+		if ((name = zpool_vdev_name(zh, zp, child[c], B_TRUE)) == NULL)
+			continue;
+		if (nvlist_lookup_string(child[c], ZPOOL_CONFIG_TYPE,
+		    &type) != 0)
+			type = "unknown";
+
+		(void) memset(&vn, 0, sizeof (vn));
+		recurse(child[c], zp, zh, &vn, logs ? NULL : disks);
+
+		groups[n] = fnvlist_alloc();
+		fnvlist_add_string(groups[n], "Name", name);
+		fnvlist_add_string(groups[n], "Type", type);
+		fnvlist_add_string_array(groups[n], "Devices", vn.vn_names,
+		    vn.vn_count);
+		n++;
+
+		vdev_names_free(&vn);
+		free(name);
 	}
 
-	if ((zp = zpool_open(zh, zpool)) == NULL) {
-		warn("zpool_open");
+	if (n > 0)
+		fnvlist_add_nvlist_array(pool_nvl, key, groups, n);
+	for (c = 0; c < n; c++)
+		nvlist_free(groups[c]);
+	free(groups);
+}
+
+/*
+ * add the cache or spare devices listed under "array" on the root vdev
+ */
+static void
+add_aux(nvlist_t *pool_nvl, const char *key, nvlist_t *nvroot,
+    const char *array, zpool_handle_t *zp, libzfs_handle_t *zh)
+{
+	nvlist_t **child;
+	uint_t c, children;
+	struct vdev_names vn;
+
+	if (nvlist_lookup_nvlist_array(nvroot, array, &child, &children) != 0 ||
+	    children == 0)
 		return;
+
+	(void) memset(&vn, 0, sizeof (vn));
+	for (c = 0; c < children; c++)
+		recurse(child[c], zp, zh, &vn, NULL);
+	fnvlist_add_string_array(pool_nvl, key, vn.vn_names, vn.vn_count);
+	vdev_names_free(&vn);
+}
+
+/*
+ * add the state and error and I/O counters of "nvl" and every vdev below
+ * it to "vdevs".  these come from the vdev_stat_t the kernel already put
+ * in the pool config, so no further ioctls are needed
+ */
+static void
+add_health(nvlist_t *vdevs, nvlist_t *nvl, const char *name,
+    zpool_handle_t *zp, libzfs_handle_t *zh)
+{
+	nvlist_t **child;
+	uint_t c, children;
+	vdev_stat_t *vs;
+	nvlist_t *vdev_nvl;
+	char *vname;
+
+	if (nvlist_lookup_uint64_array(nvl, ZPOOL_CONFIG_VDEV_STATS,
+	    (uint64_t **)&vs, &c) == 0) {
+		vdev_nvl = fnvlist_alloc();
+		fnvlist_add_string(vdev_nvl, "State",
+		    zpool_state_to_name(vs->vs_state, vs->vs_aux));
+		fnvlist_add_uint64(vdev_nvl, "Read Errors", vs->vs_read_errors);
+		fnvlist_add_uint64(vdev_nvl, "Write Errors",
+		    vs->vs_write_errors);
+		fnvlist_add_uint64(vdev_nvl, "Checksum Errors",
+		    vs->vs_checksum_errors);
+		fnvlist_add_uint64(vdev_nvl, "Read Ops",
+		    vs->vs_ops[ZIO_TYPE_READ]);
+		fnvlist_add_uint64(vdev_nvl, "Write Ops",
+		    vs->vs_ops[ZIO_TYPE_WRITE]);
+		fnvlist_add_uint64(vdev_nvl, "Read Bytes",
+		    vs->vs_bytes[ZIO_TYPE_READ]);
+		fnvlist_add_uint64(vdev_nvl, "Write Bytes",
+		    vs->vs_bytes[ZIO_TYPE_WRITE]);
+		fnvlist_add_nvlist(vdevs, name, vdev_nvl);
+		nvlist_free(vdev_nvl);
 	}
 
-	if ((zds = zfs_open(zh, zpool, ZFS_TYPE_FILESYSTEM)) == NULL) {
-		warn("zfs_open");
-		return;
+	if (nvlist_lookup_nvlist_array(nvl, ZPOOL_CONFIG_CHILDREN, &child,
+	    &children) != 0)
+		children = 0;
+	for (c = 0; c < children; c++) {
+		uint64_t ishole = B_FALSE;
+
+		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
+		    &ishole);
+		if (ishole)
+			continue;
+		if ((vname = zpool_vdev_name(zh, zp, child[c], B_TRUE)) == NULL)
+			continue;
+		add_health(vdevs, child[c], vname, zp, zh);
+		free(vname);
 	}
+}
 
-	/*
-	 * this is called "Zpool Creation", but really this is the creation
-	 * time of the root dataset- A carry-over from the bash sysinfo script
-	 */
-	fnvlist_add_int32(root_nvl, "Zpool Creation",
-	    zfs_prop_get_int(zds, ZFS_PROP_CREATION));
+static void
+add_health_aux(nvlist_t *vdevs, nvlist_t *nvroot, const char *array,
+    zpool_handle_t *zp, libzfs_handle_t *zh)
+{
+	nvlist_t **child;
+	uint_t c, children;
+	char *vname;
 
-	/*
-	 * this is called "Zpool Size in Gib", but really this is the used +
-	 * available space of the root dataset- A carry-over from the bash
-	 * sysinfo script as well.  Note that the "Size" property of the zpool
-	 * itself will yield a different value than this will generate.
-	 */
-	size += zfs_prop_get_int(zds, ZFS_PROP_USED) / 1024 / 1024 / 1024;
-	size += zfs_prop_get_int(zds, ZFS_PROP_AVAILABLE) / 1024 / 1024 / 1024;
-	fnvlist_add_int32(root_nvl, "Zpool Size in GiB", size);
+	if (nvlist_lookup_nvlist_array(nvroot, array, &child, &children) != 0)
+		return;
+	for (c = 0; c < children; c++) {
+		if ((vname = zpool_vdev_name(zh, zp, child[c], B_TRUE)) == NULL)
+			continue;
+		add_health(vdevs, child[c], vname, zp, zh);
+		free(vname);
+	}
+}
+
+static int
+do_pool(zpool_handle_t *zp, void *arg)
+{
+	struct zfs_walk *zw = arg;
+	libzfs_handle_t *zh = zw->zw_zh;
+	const char *pool = zpool_get_name(zp);
+	boolean_t syspool = strcmp(pool, zw->zw_syspool) == 0;
+	zfs_handle_t *zds;
+	nvlist_t *config;
+	nvlist_t *nvroot;
+	nvlist_t *pool_nvl;
+	nvlist_t *health_nvl;
+	nvlist_t *vdevs;
+	nvlist_t *root_health;
+	sysinfo_buf_t disks;
+	char *profile;
+	char *state;
+	int size = 0;
 
-	/*
-	 * find disks in the zpool
-	 */
-	alldevices[0] = '\0';
 	config = zpool_get_config(zp, NULL);
-	nvlist_lookup_nvlist(config, ZPOOL_CONFIG_VDEV_TREE, &nvroot);
-	recurse(nvroot, zp, zh, alldevices);
-	fnvlist_add_string(root_nvl, "Zpool Disks", alldevices);
+	if (config == NULL || nvlist_lookup_nvlist(config,
+	    ZPOOL_CONFIG_VDEV_TREE, &nvroot) != 0) {
+		zpool_close(zp);
+		return (0);
+	}
+
+	pool_nvl = fnvlist_alloc();
+	sysinfo_buf_init(&disks);
+
+	if ((zds = zfs_open(zh, pool, ZFS_TYPE_FILESYSTEM)) != NULL) {
+		/*
+		 * "Creation" is the creation time of the root dataset and
+		 * "Size in GiB" is its used + available space rather than the
+		 * pool's "Size" property, both carry-overs from the bash
+		 * sysinfo script
+		 */
+		size += zfs_prop_get_int(zds, ZFS_PROP_USED) /
+		    1024 / 1024 / 1024;
+		size += zfs_prop_get_int(zds, ZFS_PROP_AVAILABLE) /
+		    1024 / 1024 / 1024;
+		fnvlist_add_int32(pool_nvl, "Creation",
+		    zfs_prop_get_int(zds, ZFS_PROP_CREATION));
+		fnvlist_add_int32(pool_nvl, "Size in GiB", size);
+		if (syspool) {
+			fnvlist_add_int32(zw->zw_root, "Zpool Creation",
+			    zfs_prop_get_int(zds, ZFS_PROP_CREATION));
+			fnvlist_add_int32(zw->zw_root, "Zpool Size in GiB",
+			    size);
+		}
+		zfs_close(zds);
+	} else {
+		warn("zfs_open(%s)", pool);
+	}
+
+	add_vdevs(pool_nvl, "Vdevs", nvroot, zp, zh, B_FALSE, &disks);
+	add_vdevs(pool_nvl, "Logs", nvroot, zp, zh, B_TRUE, NULL);
+	add_aux(pool_nvl, "Cache", nvroot, ZPOOL_CONFIG_L2CACHE, zp, zh);
+	add_aux(pool_nvl, "Spares", nvroot, ZPOOL_CONFIG_SPARES, zp, zh);
+
+	sysinfo_buf_append(&disks, "", 1);
+	if (!disks.sb_error) {
+		fnvlist_add_string(pool_nvl, "Disks", disks.sb_data);
+		if (syspool)
+			fnvlist_add_string(zw->zw_root, "Zpool Disks",
+			    disks.sb_data);
+	}
+
+	if ((profile = get_zpool_profile(nvroot)) != NULL) {
+		fnvlist_add_string(pool_nvl, "Profile", profile);
+		if (syspool)
+			fnvlist_add_string(zw->zw_root, "Zpool Profile",
+			    profile);
+	}
+
+	fnvlist_add_nvlist(zw->zw_pools, pool, pool_nvl);
+	nvlist_free(pool_nvl);
 
 	/*
-	 * get zpool profile
+	 * the root vdev's state is the pool's.  cache and spare devices hang
+	 * off the root in their own arrays rather than as children.  the
+	 * root itself is listed under the pool's name
 	 */
-	fnvlist_add_string(root_nvl, "Zpool Profile", get_zpool_profile(nvroot));
-
-done:
+	health_nvl = fnvlist_alloc();
+	vdevs = fnvlist_alloc();
+	add_health(vdevs, nvroot, pool, zp, zh);
+	add_health_aux(vdevs, nvroot, ZPOOL_CONFIG_L2CACHE, zp, zh);
+	add_health_aux(vdevs, nvroot, ZPOOL_CONFIG_SPARES, zp, zh);
+	if (nvlist_lookup_nvlist(vdevs, pool, &root_health) == 0 &&
+	    nvlist_lookup_string(root_health, "State", &state) == 0)
+		fnvlist_add_string(health_nvl, "State", state);
+	fnvlist_add_nvlist(health_nvl, "Vdevs", vdevs);
+	fnvlist_add_nvlist(zw->zw_health, pool, health_nvl);
+	nvlist_free(vdevs);
+	nvlist_free(health_nvl);
+	sysinfo_buf_free(&disks);
 	zpool_close(zp);
-	zfs_close(zds);
-	libzfs_fini(zh);
+	return (0);
+}
+
+/*
+ * every imported pool is reported under "Zpools", found in one pass over
+ * the pools with the context's libzfs handle.  the "Zpool*" keys describe
+ * the pool smartdc is configured to use, as they always have
+ */
+void
+sysinfo_zfs(sysinfo_ctx_t *ctx, nvlist_t *root_nvl)
+{
+	char zpool[2048];
+	libzfs_handle_t *zh;
+	struct zfs_walk zw;
+
+	zpool[0] = '\0';
+	get_zpool_name(zpool, sizeof (zpool));
+
+	fnvlist_add_string(root_nvl, "Zpool", zpool);
+
+	/* get ZFS and zpool information */
+	if ((zh = sysinfo_ctx_zfs(ctx)) == NULL)
+		return;
+
+	zw.zw_zh = zh;
+	zw.zw_syspool = zpool;
+	zw.zw_root = root_nvl;
+	zw.zw_pools = fnvlist_alloc();
+	zw.zw_health = fnvlist_alloc();
+
+	if (zpool_iter(zh, do_pool, &zw) != 0)
+		warnx("zpool_iter failed");
+
+	fnvlist_add_nvlist(root_nvl, "Zpools", zw.zw_pools);
+	fnvlist_add_nvlist(root_nvl, "Zpool Health", zw.zw_health);
+	nvlist_free(zw.zw_pools);
+	nvlist_free(zw.zw_health);
 }
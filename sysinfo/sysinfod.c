@@ -0,0 +1,379 @@
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <libnvpair.h>
+
+#include "sysinfo.h"
+
+/*
+ * sysinfod - gather sysinfo once, keep the result in memory and hand it
+ * out over a UNIX domain socket, refreshing it in the background
+ */
+
+static struct {
+	int opt_i; /* -i <secs>, refresh interval */
+	int opt_j; /* -j <n>, number of collector threads */
+	char *opt_s; /* -s <path>, socket path */
+} opts;
+
+/*
+ * the last gathered document, both as an nvlist (to answer requests for a
+ * subset of keys) and rendered (to answer requests for everything), along
+ * with the sections and input stamps it was built from.  "lock" protects
+ * readers from a swap; "refresh_lock" serializes refreshes, which are the
+ * only writers of sections, stamps and cksum and the only users of "ctx".
+ * the context lives as long as the daemon, so the platform handles are
+ * opened once rather than on every refresh
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_mutex_t refresh_lock;
+	sysinfo_ctx_t *ctx;
+	nvlist_t *doc;
+	sysinfo_buf_t json;
+	nvlist_t *sections;
+	uint64_t *stamps;
+	uint64_t cksum;	/* sc_cksum of the cache file the data matches */
+} state = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+
+static void
+usage(FILE *f)
+{
+	fprintf(f, "Usage: sysinfod [-h] [-i secs] [-j threads] [-s path]\n");
+	fprintf(f, "\n");
+	fprintf(f, "Serve sysinfo data over a UNIX domain socket\n");
+	fprintf(f, "\n");
+	fprintf(f, "Options\n");
+	fprintf(f, "  -h        print this message and exit\n");
+	fprintf(f, "  -i <secs> refresh interval (default 60)\n");
+	fprintf(f, "  -j <n>    run the collectors on <n> threads\n");
+	fprintf(f, "  -s <path> socket path (default %s)\n", SYSINFOD_SOCKET);
+}
+
+static void
+render(nvlist_t *nvl, sysinfo_buf_t *buf)
+{
+	sysinfo_json_t j;
+
+	sysinfo_json_init(&j, buf, B_FALSE);
+	sysinfo_json_nvlist(&j, nvl);
+	sysinfo_buf_append(buf, "\n", 1);
+}
+
+/*
+ * make a new document current.  takes ownership of everything passed in;
+ * called with refresh_lock held
+ */
+static void
+swap(nvlist_t *nvl, sysinfo_buf_t *buf, nvlist_t *sections,
+    uint64_t *stamps)
+{
+	(void) pthread_mutex_lock(&state.lock);
+	nvlist_free(state.doc);
+	sysinfo_buf_free(&state.json);
+	nvlist_free(state.sections);
+	free(state.stamps);
+	state.doc = nvl;
+	state.json = *buf;
+	state.sections = sections;
+	state.stamps = stamps;
+	(void) pthread_mutex_unlock(&state.lock);
+	sysinfo_buf_init(buf);
+}
+
+/*
+ * gather a new document and swap it in.  a full refresh re-runs every
+ * collector; otherwise only the collectors whose inputs have moved since
+ * the last refresh are re-run and everything else is reused.  the cache
+ * file is refreshed as well so the CLI's own fallback stays current
+ */
+static int
+refresh(boolean_t full)
+{
+	int ret = -1;
+	int i, n, nstale = 0;
+	uint64_t *stamps = NULL;
+	boolean_t *stale = NULL;
+	nvlist_t *sections = NULL;
+	nvlist_t *nvl = NULL;
+	sysinfo_buf_t buf;
+
+	(void) pthread_mutex_lock(&state.refresh_lock);
+	sysinfo_buf_init(&buf);
+
+	n = sysinfo_collector_count();
+	if ((stamps = calloc(n, sizeof (uint64_t))) == NULL ||
+	    (stale = calloc(n, sizeof (boolean_t))) == NULL) {
+		warn("calloc");
+		goto done;
+	}
+	sysinfo_stamps(stamps);
+
+	if (!full && state.sections != NULL) {
+		for (i = 0; i < n; i++) {
+			stale[i] = stamps[i] != state.stamps[i];
+			if (stale[i])
+				nstale++;
+		}
+		if (nstale == 0) {
+			ret = 0;
+			goto done;
+		}
+		sysinfo_ctx_refresh(state.ctx);
+		sections = fnvlist_dup(state.sections);
+		if (sysinfo_refresh_sections(state.ctx, sections, opts.opt_j,
+		    stale, NULL) != 0)
+			goto done;
+	} else {
+		sysinfo_ctx_refresh(state.ctx);
+		if ((sections = sysinfo_gather_sections(state.ctx, opts.opt_j,
+		    NULL, NULL)) == NULL)
+			goto done;
+	}
+
+	if ((nvl = sysinfo_assemble(sections, NULL)) == NULL)
+		goto done;
+
+	render(nvl, &buf);
+	if (buf.sb_error)
+		goto done;
+	(void) sysinfo_cache_write(stamps, sections, buf.sb_data, buf.sb_len,
+	    &state.cksum);
+
+	swap(nvl, &buf, sections, stamps);
+
+	// now owned by "state"
+	nvl = NULL;
+	sections = NULL;
+	stamps = NULL;
+	ret = 0;
+
+done:
+	(void) pthread_mutex_unlock(&state.refresh_lock);
+	sysinfo_buf_free(&buf);
+	nvlist_free(nvl);
+	nvlist_free(sections);
+	free(stamps);
+	free(stale);
+	return (ret);
+}
+
+/*
+ * take the document from the cache file if someone else has rewritten it
+ * since (sysinfo -f or -u, say after a change the input stamps don't
+ * cover).  this maps and unpacks the file but never runs a collector, and
+ * is skipped while a refresh is running, whose result will be newer anyway
+ */
+static void
+adopt_cache(void)
+{
+	sysinfo_cache_t cache;
+	sysinfo_buf_t buf;
+	nvlist_t *sections = NULL;
+	nvlist_t *nvl = NULL;
+	uint64_t *stamps = NULL;
+
+	if (pthread_mutex_trylock(&state.refresh_lock) != 0)
+		return;
+
+	sysinfo_buf_init(&buf);
+	if (sysinfo_cache_open(&cache) != 0) {
+		(void) pthread_mutex_unlock(&state.refresh_lock);
+		return;
+	}
+	if (cache.sc_cksum == state.cksum)
+		goto done;
+
+	if ((stamps = calloc(sysinfo_collector_count(),
+	    sizeof (uint64_t))) == NULL ||
+	    (sections = sysinfo_cache_sections(&cache)) == NULL ||
+	    (nvl = sysinfo_assemble(sections, NULL)) == NULL)
+		goto done;
+	sysinfo_cache_stamps(&cache, stamps);
+	sysinfo_buf_append(&buf, cache.sc_json, cache.sc_jsonlen);
+	if (buf.sb_error)
+		goto done;
+
+	swap(nvl, &buf, sections, stamps);
+	state.cksum = cache.sc_cksum;
+
+	// now owned by "state"
+	nvl = NULL;
+	sections = NULL;
+	stamps = NULL;
+
+done:
+	sysinfo_cache_close(&cache);
+	(void) pthread_mutex_unlock(&state.refresh_lock);
+	sysinfo_buf_free(&buf);
+	nvlist_free(nvl);
+	nvlist_free(sections);
+	free(stamps);
+}
+
+/*
+ * refresh everything every opt_i seconds
+ */
+static void *
+refresher(void *arg)
+{
+	for (;;) {
+		(void) sleep(opts.opt_i);
+		if (refresh(B_TRUE) != 0)
+			warnx("refresh failed, keeping previous data");
+	}
+	return (NULL);
+}
+
+/*
+ * read the single request line, answer it and hang up.  the reply is
+ * copied out under the lock and written after it is dropped, so a slow
+ * client never holds up a refresh
+ */
+static void
+serve(int fd)
+{
+	char req[SYSINFOD_MAXREQ];
+	char *keys[SYSINFOD_MAXREQ / 2];
+	char *key, *lasts, *nl;
+	size_t len = 0;
+	ssize_t n;
+	int nkeys = 0;
+	sysinfo_buf_t buf;
+	nvlist_t *sel;
+
+	while ((nl = memchr(req, '\n', len)) == NULL) {
+		if (len == sizeof (req) - 1)
+			return;
+		if ((n = read(fd, req + len, sizeof (req) - 1 - len)) <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return;
+		}
+		len += n;
+	}
+	*nl = '\0';
+
+	/*
+	 * never answer with less than the CLI would: take a cache someone
+	 * else rewrote, then re-run the collectors whose inputs have moved,
+	 * the same check sysinfo makes against the cache.  when nothing has
+	 * moved this only fingerprints the inputs
+	 */
+	adopt_cache();
+	if (refresh(B_FALSE) != 0)
+		warnx("refresh failed, serving previous data");
+
+	for (key = strtok_r(req, ",", &lasts); key != NULL;
+	    key = strtok_r(NULL, ",", &lasts))
+		keys[nkeys++] = key;
+
+	sysinfo_buf_init(&buf);
+	(void) pthread_mutex_lock(&state.lock);
+	if (nkeys == 0) {
+		sysinfo_buf_append(&buf, state.json.sb_data, state.json.sb_len);
+	} else {
+		sel = sysinfo_select_keys(state.doc, keys, nkeys);
+		render(sel, &buf);
+		nvlist_free(sel);
+	}
+	(void) pthread_mutex_unlock(&state.lock);
+
+	if (!buf.sb_error)
+		(void) sysinfo_write_all(fd, buf.sb_data, buf.sb_len);
+	sysinfo_buf_free(&buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	int opt;
+	int sfd, cfd;
+	struct sockaddr_un sun;
+	struct timeval tv;
+	pthread_t tid;
+
+	opts.opt_i = 60;
+	opts.opt_j = 1;
+	opts.opt_s = SYSINFOD_SOCKET;
+	while ((opt = getopt(argc, argv, "hi:j:s:")) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(stdout);
+			return (0);
+		case 'i':
+			if ((opts.opt_i = sysinfo_parse_count(optarg)) < 0)
+				errx(1, "invalid interval: %s", optarg);
+			break;
+		case 'j':
+			if ((opts.opt_j = sysinfo_parse_count(optarg)) < 0)
+				errx(1, "invalid thread count: %s", optarg);
+			break;
+		case 's':
+			opts.opt_s = optarg;
+			break;
+		default:
+			usage(stderr);
+			return (1);
+		}
+	}
+
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	if ((state.ctx = sysinfo_ctx_create(B_TRUE)) == NULL)
+		return (1);
+
+	if (refresh(B_TRUE) != 0)
+		errx(1, "failed to gather initial data");
+
+	if ((sfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+
+	(void) memset(&sun, 0, sizeof (sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, opts.opt_s, sizeof (sun.sun_path)) >=
+	    sizeof (sun.sun_path))
+		errx(1, "socket path too long: %s", opts.opt_s);
+
+	(void) unlink(opts.opt_s);
+	if (bind(sfd, (struct sockaddr *)&sun, sizeof (sun)) != 0)
+		err(1, "bind(%s)", opts.opt_s);
+	// the data is world-readable through the CLI anyway
+	if (chmod(opts.opt_s, 0666) != 0)
+		err(1, "chmod(%s)", opts.opt_s);
+	if (listen(sfd, 128) != 0)
+		err(1, "listen");
+
+	if ((errno = pthread_create(&tid, NULL, refresher, NULL)) != 0)
+		err(1, "pthread_create");
+
+	// don't let a client that never sends its request wedge the daemon
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+
+	for (;;) {
+		if ((cfd = accept(sfd, NULL, NULL)) < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				warn("accept");
+			continue;
+		}
+		(void) setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv,
+		    sizeof (tv));
+		(void) setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv,
+		    sizeof (tv));
+		serve(cfd);
+		(void) close(cfd);
+	}
+
+	return (0);
+}
@@ -0,0 +1,96 @@
+/*
+ * a consumer of libsysinfo.so: linked against the library alone, through
+ * libsysinfo.h, so it only sees what the mapfile exports.  gathers once and
+ * checks the getters, refresh and the error cases.  run by `make check`
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libnvpair.h>
+
+#include "libsysinfo.h"
+
+static int failed = 0;
+
+static void
+check(const char *desc, int ok)
+{
+	if (ok) {
+		(void) printf("ok: %s\n", desc);
+	} else {
+		(void) printf("FAIL: %s\n", desc);
+		failed = 1;
+	}
+}
+
+/*
+ * -1 with errno set to "expected"
+ */
+static int
+fails_with(int ret, int expected)
+{
+	return (ret == -1 && errno == expected);
+}
+
+int
+main(void)
+{
+	sysinfo_hdl_t *h;
+	const char * const *names;
+	const char *uname[] = { "uname" };
+	nvlist_t *nvl;
+	char *s = NULL;
+	int64_t i;
+	boolean_t b;
+	int n;
+
+	if ((h = sysinfo_open(2)) == NULL) {
+		perror("sysinfo_open");
+		return (1);
+	}
+
+	check("nothing before a gather",
+	    fails_with(sysinfo_get_string(h, "Hostname", &s), ENOENT) &&
+	    sysinfo_nvlist(h) == NULL && errno == ENOENT);
+
+	names = sysinfo_collector_names();
+	for (n = 0; names != NULL && names[n] != NULL; n++)
+		;
+	check("collector names", n > 0 && strcmp(names[0], "bootparams") == 0);
+
+	check("update", sysinfo_update(h, NULL, 0) == 0);
+
+	check("string", sysinfo_get_string(h, "Hostname", &s) == 0 &&
+	    s[0] != '\0');
+	free(s);
+	s = NULL;
+	check("int", sysinfo_get_int(h, "MiB of Memory", &i) == 0 && i > 0);
+	check("boolean", sysinfo_get_boolean(h, "VM Capable", &b) == 0 &&
+	    b == B_TRUE);
+	check("wrong type", fails_with(sysinfo_get_int(h, "Hostname", &i),
+	    EINVAL));
+	check("missing key", fails_with(sysinfo_get_string(h, "No Such Key",
+	    &s), ENOENT));
+
+	check("refresh", sysinfo_refresh(h, "uname") == 0 &&
+	    sysinfo_get_string(h, "Hostname", &s) == 0);
+	free(s);
+	s = NULL;
+	check("update by name", sysinfo_update(h, uname, 1) == 0);
+	check("unknown collector", fails_with(sysinfo_refresh(h, "nope"),
+	    ENOENT));
+
+	if ((nvl = sysinfo_nvlist(h)) == NULL) {
+		check("nvlist", 0);
+	} else {
+		check("nvlist", nvlist_exists(nvl, "Hostname") &&
+		    nvlist_exists(nvl, "MiB of Memory"));
+		nvlist_free(nvl);
+	}
+
+	sysinfo_close(h);
+	return (failed);
+}